@@ -5,321 +5,6890 @@
 #include <ctime>
 #include <iomanip>
 #include <map>
+#include <unordered_map>
 #include <algorithm>
 #include <limits>
 #include <sstream>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include <string_view>
+#include <memory>
+#include <new>
+#include <functional>
+#include <charconv>
+#include <system_error>
+#include <cmath>
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#define popen _popen
+#define pclose _pclose
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC32C_HARDWARE
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <nmmintrin.h>
+#endif
+#endif
 
 using namespace std;
 
 // Constants
-const double SAVINGS_INTEREST_RATE = 0.04; // 4% annual
-const double CURRENT_INTEREST_RATE = 0.01; // 1% annual
+const int64_t SAVINGS_INTEREST_BP = 400; // 4% annual, in basis points
+const int64_t CURRENT_INTEREST_BP = 100; // 1% annual
 const int MAX_LOGIN_ATTEMPTS = 3;
+const int64_t MAX_AMOUNT_CENTS = 100000000000000; // $1 trillion, the most one typed amount may be
+
+// Binary snapshot format
+const char SNAPSHOT_MAGIC[8] = {'B', 'M', 'S', 'S', 'N', 'A', 'P', '\0'};
+const char SNAPSHOT_INDEX_MAGIC[8] = {'B', 'M', 'S', 'I', 'N', 'D', 'X', '\0'};
+const char SNAPSHOT_CHECKSUM_MAGIC[8] = {'B', 'M', 'S', 'C', 'R', 'C', 'C', '\0'};
+const uint32_t SNAPSHOT_VERSION = 6;          // 3 added the footer directory, 4 block checksums, 5 balances in cents,
+                                              // 6 holder names stored once
+const uint32_t SNAPSHOT_MIN_VERSION = 2;      // oldest version still readable
+const size_t SNAPSHOT_IO_BLOCK = 1 << 20; // 1 MiB sequential I/O blocks
+const size_t SNAPSHOT_CHECKSUM_BLOCK = 1 << 20; // bytes covered by each CRC-32C
+const uint32_t SNAPSHOT_INDEX_BLOCK = 256;  // records per footer directory entry
+const uint32_t MAX_DELTA_CHECKPOINTS = 16;  // deltas before a full snapshot is rewritten
+
+// Smallest slice of a CSV import worth handing to its own thread
+const size_t CSV_MIN_CHUNK_BYTES = 1 << 20;
+
+// Interned string storage: shards locked independently, and strings kept
+// in fixed chunks so they never move (at most 64M strings per pool)
+const size_t INTERN_SHARDS = 16;
+const size_t INTERN_CHUNK = 4096;
+const size_t INTERN_MAX_CHUNKS = 16384;
+
+// Bank-wide transaction journal: entries in fixed chunks that are never
+// moved or reallocated, found through pages of chunk pointers. The page
+// table is reused round-robin as retired pages are freed, so it only
+// limits entries held at once (2^38, far more than memory allows).
+const size_t JOURNAL_CHUNK = 4096; // entries per chunk
+const size_t JOURNAL_PAGE = 4096;  // chunk pointers per page
+const size_t JOURNAL_PAGES = 16384;
 
 // Account types
 enum AccountType { SAVINGS, CURRENT };
 
-// Transaction types
+// Transaction types, by the sign of the amount
 enum TransactionType { DEPOSIT, WITHDRAWAL, TRANSFER };
 
-// Transaction record
-struct Transaction {
-    time_t timestamp;
-    TransactionType type;
-    double amount;
-    string description;
-    double balanceAfter;
-};
+// What a transaction was; its statement text is rendered from this
+enum TransactionKind {
+    KIND_OTHER,        // text not recognised when read back from storage
+    KIND_DEPOSIT,
+    KIND_WITHDRAWAL,
+    KIND_TRANSFER_OUT, // counterparty is the receiving account
+    KIND_TRANSFER_IN,  // counterparty is the sending account
+    KIND_INTEREST,
+    KIND_PIN_CHANGE,
+    KIND_OPENING,      // compacted history before the summary window
+    KIND_SUMMARY       // a compacted month, the month of its timestamp
+};
+
+// How a computed amount that falls between two cents is rounded
+enum RoundingMode {
+    ROUND_HALF_EVEN, // nearest cent, ties to the even cent (banker's rounding)
+    ROUND_HALF_UP,   // nearest cent, ties away from zero
+    ROUND_DOWN       // toward zero
+};
+
+// Interest is credited in whole cents, rounded this way
+const RoundingMode INTEREST_ROUNDING = ROUND_HALF_EVEN;
+
+// An amount of money as a whole number of cents. Arithmetic is checked
+// and throws overflow_error instead of wrapping. Decimal text and doubles
+// are only converted at input, output and legacy file boundaries.
+class Money {
+private:
+    int64_t cents = 0;
+
+    static int64_t checkedAdd(int64_t a, int64_t b) {
+        if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) {
+            throw overflow_error("Amount out of range");
+        }
+        return a + b;
+    }
+
+    static int64_t checkedMultiply(int64_t a, int64_t b) {
+        if (a != 0 && b != 0 &&
+            (a > 0 ? (b > 0 ? a > INT64_MAX / b : b < INT64_MIN / a)
+                   : (b > 0 ? a < INT64_MIN / b : b < INT64_MAX / a))) {
+            throw overflow_error("Amount out of range");
+        }
+        return a * b;
+    }
+
+    // quotient + remainder / denominator (denominator > 0, remainder of
+    // the quotient's sign and smaller than the denominator), rounded with
+    // `mode`
+    static int64_t roundQuotient(int64_t quotient, int64_t remainder, int64_t denominator,
+                                 RoundingMode mode) {
+        int64_t magnitude = remainder < 0 ? -remainder : remainder;
+        bool roundAway = false;
+        if (mode == ROUND_HALF_UP) {
+            roundAway = magnitude >= denominator - magnitude;
+        } else if (mode == ROUND_HALF_EVEN) {
+            roundAway = magnitude > denominator - magnitude ||
+                        (magnitude == denominator - magnitude && quotient % 2 != 0);
+        }
+        if (roundAway && remainder != 0) {
+            quotient = checkedAdd(quotient, remainder < 0 ? -1 : 1);
+        }
+        return quotient;
+    }
+
+    // numerator / denominator (denominator > 0), rounded with `mode`
+    static int64_t divideRounded(int64_t numerator, int64_t denominator, RoundingMode mode) {
+        return roundQuotient(numerator / denominator, numerator % denominator, denominator, mode);
+    }
+
+public:
+    constexpr Money() = default;
+
+    static constexpr Money fromCents(int64_t cents) {
+        Money value;
+        value.cents = cents;
+        return value;
+    }
+
+    // Nearest cent to a double, as stored by older file formats
+    static Money fromDouble(double amount, RoundingMode mode = ROUND_HALF_EVEN) {
+        double scaled = amount * 100;
+        if (!(fabs(scaled) < 9.2e18)) {
+            throw overflow_error("Amount out of range");
+        }
+        double rounded = mode == ROUND_DOWN ? trunc(scaled) : (mode == ROUND_HALF_UP ? round(scaled) : nearbyint(scaled));
+        return fromCents(static_cast<int64_t>(rounded));
+    }
+
+    // Parses plain decimal text such as "12", "-0.5" or "1250.75". Digits
+    // past the cents are rounded with `mode`. Returns false on anything
+    // else, including exponents and amounts out of range.
+    static bool parse(string_view text, Money& value, RoundingMode mode = ROUND_HALF_EVEN) {
+        bool negative = !text.empty() && text[0] == '-';
+        if (negative) {
+            text.remove_prefix(1);
+        }
+        size_t point = text.find('.');
+        string_view whole = text.substr(0, point);
+        string_view fraction = point == string_view::npos ? string_view() : text.substr(point + 1);
+        if (whole.empty() && fraction.empty()) {
+            return false;
+        }
+        try {
+            int64_t total = 0;
+            for (char c : whole) {
+                if (c < '0' || c > '9') {
+                    return false;
+                }
+                total = checkedAdd(checkedMultiply(total, 10), c - '0');
+            }
+            // Keep three fraction digits, folding any beyond into a sticky
+            // digit so rounding sees whether the rest was exactly half
+            int64_t extra = 0;
+            bool sticky = false;
+            for (size_t i = 0; i < fraction.size(); i++) {
+                if (fraction[i] < '0' || fraction[i] > '9') {
+                    return false;
+                }
+                if (i < 3) {
+                    extra = extra * 10 + (fraction[i] - '0');
+                } else if (fraction[i] != '0') {
+                    sticky = true;
+                }
+            }
+            for (size_t i = fraction.size(); i < 3; i++) {
+                extra *= 10;
+            }
+            int64_t thousandths = checkedAdd(checkedMultiply(total, 1000), extra);
+            int64_t scaled = checkedAdd(checkedMultiply(thousandths, 10), sticky ? 1 : 0);
+            int64_t cents = divideRounded(negative ? -scaled : scaled, 100, mode);
+            value = fromCents(cents);
+        } catch (const overflow_error&) {
+            return false;
+        }
+        return true;
+    }
+
+    int64_t toCents() const { return cents; }
+    double toDouble() const { return cents / 100.0; }
+
+    // Plain decimal text with two fraction digits, e.g. "-12.50"
+    string toString() const {
+        uint64_t magnitude = cents < 0 ? 0 - static_cast<uint64_t>(cents) : cents;
+        string fraction = to_string(magnitude % 100);
+        return (cents < 0 ? "-" : "") + to_string(magnitude / 100) + "." +
+               (fraction.size() < 2 ? "0" : "") + fraction;
+    }
+
+    // This amount times numerator / denominator, rounded to a cent. Only
+    // the remainder after dividing is multiplied, as
+    // (cents / d) * n + (cents % d) * n / d, so any amount whose result
+    // fits can be scaled.
+    Money scale(int64_t numerator, int64_t denominator, RoundingMode mode) const {
+        int64_t whole = checkedMultiply(cents / denominator, numerator);
+        int64_t part = checkedMultiply(cents % denominator, numerator);
+        return fromCents(roundQuotient(checkedAdd(whole, part / denominator), part % denominator,
+                                       denominator, mode));
+    }
+
+    // True if adding `other` stays in range, for checking before a change
+    // that must not fail half way
+    bool canAdd(Money other) const {
+        return (other.cents <= 0 || cents <= INT64_MAX - other.cents) &&
+               (other.cents >= 0 || cents >= INT64_MIN - other.cents);
+    }
+
+    Money operator+(Money other) const { return fromCents(checkedAdd(cents, other.cents)); }
+    Money operator-(Money other) const { return *this + -other; }
+    Money operator-() const { return fromCents(checkedMultiply(cents, -1)); }
+    Money& operator+=(Money other) { return *this = *this + other; }
+    Money& operator-=(Money other) { return *this = *this - other; }
+
+    bool operator==(Money other) const { return cents == other.cents; }
+    bool operator!=(Money other) const { return cents != other.cents; }
+    bool operator<(Money other) const { return cents < other.cents; }
+    bool operator<=(Money other) const { return cents <= other.cents; }
+    bool operator>(Money other) const { return cents > other.cents; }
+    bool operator>=(Money other) const { return cents >= other.cents; }
+};
+
+ostream& operator<<(ostream& out, Money value) {
+    return out << value.toString();
+}
+
+// Transaction record: fixed size, with no heap storage. The counterparty
+// field fits any account id, which has at most 18 digits.
+struct Transaction {
+    time_t timestamp;
+    Money amount;
+    Money balanceAfter;
+    uint64_t counterparty : 60; // other account of a transfer, else 0
+    uint64_t kind : 4;          // a TransactionKind
+};
+static_assert(sizeof(Transaction) == 32 && is_trivially_copyable<Transaction>::value,
+              "Transaction should stay a compact plain record");
+
+TransactionType transactionType(const Transaction& t) {
+    return t.amount > Money() ? DEPOSIT : (t.amount < Money() ? WITHDRAWAL : TRANSFER);
+}
+
+// Account numbers are "ACCT" followed by a decimal id. Ids issued by the
+// generator are a sequence number with a Luhn check digit appended; ids
+// below ACCOUNT_ID_CHECKED_FROM were issued before check digits existed.
+const uint64_t FIRST_ACCOUNT_SEQUENCE = 1000000;
+const uint64_t ACCOUNT_ID_CHECKED_FROM = FIRST_ACCOUNT_SEQUENCE * 10;
+const uint64_t ACCOUNT_SEQUENCE_BLOCK = 1000; // sequences reserved per state file write
+
+// Luhn check digit of a sequence number
+uint32_t accountCheckDigit(uint64_t sequence) {
+    uint32_t sum = 0;
+    for (bool doubled = true; sequence > 0; sequence /= 10, doubled = !doubled) {
+        uint32_t digit = sequence % 10;
+        if (doubled) {
+            digit *= 2;
+            if (digit > 9) {
+                digit -= 9;
+            }
+        }
+        sum += digit;
+    }
+    return (10 - sum % 10) % 10;
+}
+
+uint64_t makeAccountId(uint64_t sequence) {
+    return sequence * 10 + accountCheckDigit(sequence);
+}
+
+// True if the id could have been issued: a legacy id, or one whose check
+// digit matches. Catches single mistyped digits and most swapped pairs.
+bool isValidAccountId(uint64_t id) {
+    return id != 0 && (id < ACCOUNT_ID_CHECKED_FROM || id % 10 == accountCheckDigit(id / 10));
+}
+
+// Parses the "ACCTnnnn" form. Only the canonical spelling is accepted
+// (no leading zeros, at most 18 digits) so each id has one account number.
+bool parseAccountNumber(string_view accNum, uint64_t& id) {
+    const size_t prefix = 4;
+    if (accNum.size() <= prefix || accNum.size() > prefix + 18 ||
+        accNum.substr(0, prefix) != "ACCT" || accNum[prefix] == '0') {
+        return false;
+    }
+    id = 0;
+    for (size_t i = prefix; i < accNum.size(); i++) {
+        if (accNum[i] < '0' || accNum[i] > '9') {
+            return false;
+        }
+        id = id * 10 + (accNum[i] - '0');
+    }
+    return true;
+}
+
+string formatAccountNumber(uint64_t id) {
+    char text[24] = {'A', 'C', 'C', 'T'};
+    auto result = to_chars(text + 4, text + sizeof(text), id);
+    return string(text, result.ptr - text);
+}
+
+// Orders ids as their account number strings sort, which is the order
+// snapshot records are stored and searched in
+bool accountNumberLess(uint64_t a, uint64_t b) {
+    auto digits = [](uint64_t v) {
+        int count = 1;
+        for (; v >= 10; v /= 10) {
+            count++;
+        }
+        return count;
+    };
+    int aDigits = digits(a), bDigits = digits(b);
+    // Scale both to the same length; on a tie the shorter one is a prefix
+    for (int i = aDigits; i < bDigits; i++) {
+        a *= 10;
+    }
+    for (int i = bDigits; i < aDigits; i++) {
+        b *= 10;
+    }
+    return a != b ? a < b : aDigits < bDigits;
+}
+
+// Breaks a timestamp into local time without localtime's shared buffer,
+// so the compaction thread can call it alongside the menu
+tm localTime(time_t timestamp) {
+    tm local = {};
+#ifdef _WIN32
+    localtime_s(&local, &timestamp);
+#else
+    localtime_r(&timestamp, &local);
+#endif
+    return local;
+}
+
+const size_t TRANSACTION_TEXT_MAX = 40; // longest is "Transfer from " + an account number
+
+// Writes a transaction's statement text, e.g. "Transfer to ACCT10000016",
+// into `text` and returns its length
+size_t describeTransaction(const Transaction& t, char (&text)[TRANSACTION_TEXT_MAX]) {
+    auto copy = [&text](const char* prefix) {
+        size_t length = strlen(prefix);
+        memcpy(text, prefix, length);
+        return length;
+    };
+    switch (t.kind) {
+        case KIND_DEPOSIT: return copy("Deposit");
+        case KIND_WITHDRAWAL: return copy("Withdrawal");
+        case KIND_INTEREST: return copy("Interest Credited");
+        case KIND_PIN_CHANGE: return copy("PIN Changed");
+        case KIND_OPENING: return copy("Opening Balance");
+        case KIND_TRANSFER_OUT:
+        case KIND_TRANSFER_IN: {
+            size_t length = copy(t.kind == KIND_TRANSFER_OUT ? "Transfer to ACCT" : "Transfer from ACCT");
+            return to_chars(text + length, text + sizeof(text), uint64_t(t.counterparty)).ptr - text;
+        }
+        case KIND_SUMMARY: {
+            tm local = localTime(t.timestamp);
+            return snprintf(text, sizeof(text), "Monthly Summary %04d-%02d", local.tm_year + 1900, local.tm_mon + 1);
+        }
+        default: return copy("Other");
+    }
+}
+
+string transactionText(const Transaction& t) {
+    char text[TRANSACTION_TEXT_MAX];
+    return string(text, describeTransaction(t, text));
+}
+
+// True if two records describe the same event, as when matching history
+// against the log records it was written from
+bool sameTransaction(const Transaction& a, const Transaction& b) {
+    return a.timestamp == b.timestamp && a.amount == b.amount && a.balanceAfter == b.balanceAfter &&
+           a.kind == b.kind && a.counterparty == b.counterparty;
+}
+
+// Sets a transaction's kind and counterparty from the statement text that
+// storage formats hold. Text this program never writes becomes KIND_OTHER.
+void parseTransactionText(string_view text, Transaction& t) {
+    static const pair<const char*, TransactionKind> fixed[] = {
+        {"Deposit", KIND_DEPOSIT}, {"Withdrawal", KIND_WITHDRAWAL}, {"Interest Credited", KIND_INTEREST},
+        {"PIN Changed", KIND_PIN_CHANGE}, {"Opening Balance", KIND_OPENING}};
+    t.counterparty = 0;
+    for (const auto& entry : fixed) {
+        if (text == entry.first) {
+            t.kind = entry.second;
+            return;
+        }
+    }
+    uint64_t id;
+    const string_view transferTo = "Transfer to ", transferFrom = "Transfer from ";
+    if (text.substr(0, transferTo.size()) == transferTo && parseAccountNumber(text.substr(transferTo.size()), id)) {
+        t.kind = KIND_TRANSFER_OUT;
+        t.counterparty = id;
+    } else if (text.substr(0, transferFrom.size()) == transferFrom &&
+               parseAccountNumber(text.substr(transferFrom.size()), id)) {
+        t.kind = KIND_TRANSFER_IN;
+        t.counterparty = id;
+    } else if (text.substr(0, 16) == "Monthly Summary ") {
+        t.kind = KIND_SUMMARY;
+    } else {
+        t.kind = KIND_OTHER;
+    }
+}
+
+// Binary encoding helpers
+template <typename T>
+void putValue(vector<char>& buffer, const T& value) {
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+void putString(vector<char>& buffer, const string& s) {
+    putValue<uint32_t>(buffer, s.size());
+    buffer.insert(buffer.end(), s.begin(), s.end());
+}
+
+// Writes a transaction's text as putString would, without building a string
+void putTransactionText(vector<char>& buffer, const Transaction& t) {
+    char text[TRANSACTION_TEXT_MAX];
+    size_t length = describeTransaction(t, text);
+    putValue<uint32_t>(buffer, length);
+    buffer.insert(buffer.end(), text, text + length);
+}
+
+// Writes an account number as putString would, without building a string
+void putAccountNumber(vector<char>& buffer, uint64_t id) {
+    char text[24] = {'A', 'C', 'C', 'T'};
+    size_t length = to_chars(text + 4, text + sizeof(text), id).ptr - text;
+    putValue<uint32_t>(buffer, length);
+    buffer.insert(buffer.end(), text, text + length);
+}
+
+// LEB128 variable-length integers; signed values are zigzag-mapped first
+// so small negative numbers stay short
+void putVarint(vector<char>& buffer, uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<char>(value));
+}
+
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Bounds-checked cursor over an encoded byte range
+class ByteReader {
+private:
+    const char* data;
+    size_t size;
+    size_t pos = 0;
+
+public:
+    ByteReader(const char* data, size_t size) : data(data), size(size) {}
+
+    size_t remaining() const { return size - pos; }
+
+    template <typename T>
+    bool get(T& value) {
+        if (remaining() < sizeof(T)) {
+            return false;
+        }
+        memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    bool getString(string& s) {
+        string_view view;
+        if (!getStringView(view)) {
+            return false;
+        }
+        s.assign(view.data(), view.size());
+        return true;
+    }
+
+    // Like getString, but points into the buffer instead of copying
+    bool getStringView(string_view& s) {
+        uint32_t length;
+        if (!get(length) || remaining() < length) {
+            return false;
+        }
+        s = string_view(data + pos, length);
+        pos += length;
+        return true;
+    }
+
+    // Reads an amount stored as int64 cents, or as a double in records
+    // written before amounts were kept in cents
+    bool getMoney(Money& value, bool cents) {
+        if (cents) {
+            int64_t stored;
+            if (!get(stored)) {
+                return false;
+            }
+            value = Money::fromCents(stored);
+            return true;
+        }
+        double stored;
+        if (!get(stored) || !(fabs(stored * 100) < 9.2e18)) {
+            return false;
+        }
+        value = Money::fromDouble(stored);
+        return true;
+    }
+
+    bool getVarint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && pos < size; shift += 7) {
+            uint8_t byte = data[pos++];
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Returns the next `count` bytes in place, or nullptr if too few remain
+    const char* take(size_t count) {
+        if (remaining() < count) {
+            return nullptr;
+        }
+        const char* start = data + pos;
+        pos += count;
+        return start;
+    }
+};
+
+// Minimal LZ77 block compressor for archived history. The output is a
+// series of varint literal length, literal bytes, varint match length and
+// varint match distance; a match length of 0 ends the block.
+vector<char> lzCompress(const vector<char>& input) {
+    const size_t MIN_MATCH = 4;
+    const int HASH_BITS = 14;
+    vector<uint32_t> table(1 << HASH_BITS, UINT32_MAX);
+    vector<char> out;
+    size_t anchor = 0, pos = 0;
+
+    auto emitLiterals = [&](size_t end) {
+        putVarint(out, end - anchor);
+        out.insert(out.end(), input.begin() + anchor, input.begin() + end);
+    };
+    while (pos + MIN_MATCH <= input.size()) {
+        uint32_t word;
+        memcpy(&word, input.data() + pos, sizeof(word));
+        uint32_t slot = (word * 2654435761u) >> (32 - HASH_BITS);
+        uint32_t candidate = table[slot];
+        table[slot] = pos;
+        if (candidate == UINT32_MAX || memcmp(input.data() + candidate, input.data() + pos, MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+        size_t length = MIN_MATCH;
+        while (pos + length < input.size() && input[candidate + length] == input[pos + length]) {
+            length++;
+        }
+        emitLiterals(pos);
+        putVarint(out, length);
+        putVarint(out, pos - candidate);
+        pos += length;
+        anchor = pos;
+    }
+    emitLiterals(input.size());
+    putVarint(out, 0);
+    return out;
+}
+
+bool lzDecompress(const char* data, size_t size, size_t rawLength, vector<char>& out) {
+    ByteReader reader(data, size);
+    out.clear();
+    out.reserve(rawLength);
+    while (true) {
+        uint64_t literals, length, distance;
+        if (!reader.getVarint(literals) || literals > rawLength - out.size()) {
+            return false;
+        }
+        const char* bytes = reader.take(literals);
+        if (!bytes || !reader.getVarint(length)) {
+            return false;
+        }
+        out.insert(out.end(), bytes, bytes + literals);
+        if (length == 0) {
+            return out.size() == rawLength;
+        }
+        if (!reader.getVarint(distance) || distance == 0 || distance > out.size() ||
+            length > rawLength - out.size()) {
+            return false;
+        }
+        // Byte by byte: a match may overlap the bytes it produces
+        size_t from = out.size() - distance;
+        for (uint64_t i = 0; i < length; i++) {
+            out.push_back(out[from + i]);
+        }
+    }
+}
+
+// CRC-32C (Castagnoli) checksums for snapshot blocks and log records.
+// x86-64 CPUs with SSE4.2 compute it in hardware; everything else uses
+// a slicing-by-8 table.
+const uint32_t CRC32C_POLY = 0x82f63b78; // reflected
+
+struct Crc32cTables {
+    uint32_t table[8][256];
+
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+            }
+            table[0][i] = crc;
+        }
+        for (int k = 1; k < 8; k++) {
+            for (uint32_t i = 0; i < 256; i++) {
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+uint32_t crc32cSoftware(uint32_t crc, const char* data, size_t size) {
+    static const Crc32cTables tables;
+    const auto& t = tables.table;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        word ^= crc;
+        crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff] ^
+              t[4][(word >> 24) & 0xff] ^ t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^
+              t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+    }
+    for (; size > 0; p++, size--) {
+        crc = t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#ifdef CRC32C_HARDWARE
+#ifndef _MSC_VER
+__attribute__((target("sse4.2")))
+#endif
+uint32_t crc32cHardware(uint32_t crc, const char* data, size_t size) {
+    uint64_t crc64 = ~crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    uint32_t crc32 = static_cast<uint32_t>(crc64);
+    for (; size > 0; data++, size--) {
+        crc32 = _mm_crc32_u8(crc32, static_cast<unsigned char>(*data));
+    }
+    return ~crc32;
+}
+#endif
+
+bool crc32cHasHardware() {
+#if defined(CRC32C_HARDWARE) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    static const bool supported = (info[2] & (1 << 20)) != 0;
+    return supported;
+#elif defined(CRC32C_HARDWARE)
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+// Extends `crc` (0 to start) over the bytes, in hardware when available
+uint32_t crc32c(const char* data, size_t size, uint32_t crc = 0) {
+#ifdef CRC32C_HARDWARE
+    if (crc32cHasHardware()) {
+        return crc32cHardware(crc, data, size);
+    }
+#endif
+    return crc32cSoftware(crc, data, size);
+}
+
+// Checksums consecutive blocks of blockSize bytes (the last may be
+// short), spreading the blocks over the available cores
+vector<uint32_t> crc32cBlocks(const char* data, uint64_t size, size_t blockSize) {
+    size_t blockCount = (size + blockSize - 1) / blockSize;
+    vector<uint32_t> sums(blockCount);
+    size_t threadCount = min<size_t>(max(1u, thread::hardware_concurrency()), blockCount);
+    auto sumStripe = [&](size_t first) {
+        for (size_t block = first; block < blockCount; block += threadCount) {
+            uint64_t offset = uint64_t(block) * blockSize;
+            sums[block] = crc32c(data + offset, min<uint64_t>(blockSize, size - offset));
+        }
+    };
+    vector<thread> workers;
+    for (size_t i = 1; i < threadCount; i++) {
+        workers.emplace_back(sumStripe, i);
+    }
+    if (threadCount > 0) {
+        sumStripe(0);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return sums;
+}
+
+// Write-ahead log record kinds
+enum LogRecordKind : uint8_t { LOG_CREATE = 1, LOG_TRANSACTION = 2, LOG_PIN = 3, LOG_CLOSE = 4 };
+
+// Group commit defaults for the transaction log
+const size_t LOG_MAX_BATCH_RECORDS = 256;
+const int LOG_MAX_BATCH_WAIT_MICROS = 0; // flush as soon as the disk is free
+
+// Set in a log record's length when a CRC-32C of the payload follows it;
+// records written before checksums were added lack it
+const uint32_t LOG_CHECKSUMMED = 0x80000000u;
+
+// Set in a log record's kind when its amounts are int64 cents; older
+// records carry doubles
+const uint8_t LOG_CENTS = 0x80;
+
+// Forces written data to stable storage
+bool syncFile(FILE* file) {
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Cuts an open file back to `size` bytes
+bool truncateFile(FILE* file, uint64_t size) {
+    clearerr(file);
+#ifdef _WIN32
+    return _chsize_s(_fileno(file), size) == 0;
+#else
+    return ftruncate(fileno(file), size) == 0;
+#endif
+}
+
+// Makes renames and removals in the directory holding `path` durable.
+// Windows has no directory handle to sync; MOVEFILE_WRITE_THROUGH covers
+// the renames that need it.
+bool syncDirectoryOf(const string& path) {
+#ifdef _WIN32
+    (void)path;
+    return true;
+#else
+    size_t slash = path.rfind('/');
+    string directory = slash == string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = ::open(directory.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+#endif
+}
+
+// Moves a fully written temporary file over `target` in one step, so a
+// crash leaves either the old file or the new one, never neither. On
+// POSIX the directory is then fsynced so the rename itself is durable.
+bool replaceFileAtomically(const string& tempFile, const string& target) {
+#ifdef _WIN32
+    return MoveFileExA(tempFile.c_str(), target.c_str(),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(tempFile.c_str(), target.c_str()) == 0 && syncDirectoryOf(target);
+#endif
+}
+
+// Writes bytes to a file in large blocks and fsyncs it
+bool writeFileDurably(string filename, const vector<char>& bytes) {
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file) {
+        cerr << "Error writing " << filename << ".\n";
+        return false;
+    }
+    bool ok = true;
+    for (size_t done = 0; ok && done < bytes.size(); done += SNAPSHOT_IO_BLOCK) {
+        size_t chunk = min(SNAPSHOT_IO_BLOCK, bytes.size() - done);
+        ok = fwrite(bytes.data() + done, 1, chunk, file) == chunk;
+    }
+    ok = ok && fflush(file) == 0 && syncFile(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        cerr << "Error writing " << filename << ".\n";
+    }
+    return ok;
+}
+
+// Group commit statistics for the transaction log
+struct LogStats {
+    uint64_t batches = 0;
+    uint64_t records = 0;
+    uint64_t largestBatch = 0;
+    double totalCommitMicros = 0;
+    double maxCommitMicros = 0;
+};
+
+// Append-only write-ahead log. Each record is a uint32 payload length
+// followed by the payload, whose first byte is a LogRecordKind.
+//
+// Appends use group commit: records from concurrent callers queue up
+// while a leader thread writes and fsyncs the previous batch, and the
+// next caller to find the disk idle writes everything queued (up to
+// maxBatchRecords) with a single write+fsync. Every caller blocks until
+// the batch holding its record is durable.
+class TransactionLog {
+private:
+    struct PendingRecord {
+        vector<char> bytes;
+        chrono::steady_clock::time_point queuedAt;
+        bool* failed; // the waiting appender's flag, set if its batch fails
+    };
+
+    FILE* file = nullptr;
+    string filename;
+    mutex lock;
+    condition_variable batchChanged;
+    deque<PendingRecord> pending;
+    uint64_t queuedSeq = 0;  // sequence number of the last queued record
+    uint64_t settledSeq = 0; // every record up to here is on disk or failed
+    uint64_t fileEnd = 0;    // size of the log once its last good batch was written
+    bool broken = false;     // a failed batch could not be cut off the end
+    bool flushing = false;
+    size_t maxBatchRecords = LOG_MAX_BATCH_RECORDS;
+    chrono::microseconds maxBatchWait{LOG_MAX_BATCH_WAIT_MICROS};
+    LogStats stats;
+
+    // Returns once the record is on disk. Throws if it could not be
+    // written, in which case it is not in the log either, so callers log
+    // a change before applying it.
+    void append(const vector<char>& payload) {
+        unique_lock<mutex> guard(lock);
+        if (!file) {
+            return;
+        }
+        if (broken) {
+            throw runtime_error("Transaction log " + filename + " is unusable after a failed write");
+        }
+
+        bool failed = false;
+        PendingRecord record;
+        uint32_t length = payload.size();
+        putValue(record.bytes, length | LOG_CHECKSUMMED);
+        putValue(record.bytes, crc32c(payload.data(), payload.size()));
+        record.bytes.insert(record.bytes.end(), payload.begin(), payload.end());
+        record.queuedAt = chrono::steady_clock::now();
+        record.failed = &failed;
+        pending.push_back(move(record));
+        uint64_t mySeq = ++queuedSeq;
+        if (pending.size() >= maxBatchRecords) {
+            batchChanged.notify_all();
+        }
+
+        while (settledSeq < mySeq) {
+            if (flushing) {
+                batchChanged.wait(guard);
+            } else {
+                flushBatch(guard);
+            }
+        }
+        if (failed) {
+            throw runtime_error("Transaction log write failed");
+        }
+    }
+
+    // Appends the whole of `source` to `target` and makes it durable. On
+    // failure `target` is cut back to its old length, so it never holds
+    // part of the records.
+    static bool appendDurably(const string& source, const string& target) {
+        ifstream in(source, ios::binary);
+        FILE* out = fopen(target.c_str(), "ab");
+        if (!in.is_open() || !out) {
+            if (out) {
+                fclose(out);
+            }
+            return false;
+        }
+        fseek(out, 0, SEEK_END);
+        int64_t original = ftell(out);
+        vector<char> block(SNAPSHOT_IO_BLOCK);
+        bool ok = original >= 0;
+        while (ok) {
+            in.read(block.data(), block.size());
+            size_t got = in.gcount();
+            if (got == 0) {
+                break;
+            }
+            ok = fwrite(block.data(), 1, got, out) == got;
+        }
+        ok = ok && !in.bad() && fflush(out) == 0 && syncFile(out);
+        if (!ok && original >= 0 && truncateFile(out, original)) {
+            syncFile(out);
+        }
+        ok = fclose(out) == 0 && ok;
+        return ok && syncDirectoryOf(target);
+    }
+
+    // Cuts a failed batch off the end of the file, so later batches are
+    // not written after a torn record that replay would stop at
+    bool truncateTo(uint64_t size) {
+        return truncateFile(file, size) && syncFile(file);
+    }
+
+    // Runs with the lock held on entry and exit; drops it around the I/O
+    void flushBatch(unique_lock<mutex>& guard) {
+        flushing = true;
+        if (maxBatchWait.count() > 0) {
+            batchChanged.wait_for(guard, maxBatchWait, [this] {
+                return pending.size() >= maxBatchRecords;
+            });
+        }
+
+        size_t count = min(pending.size(), maxBatchRecords);
+        vector<char> batch;
+        vector<chrono::steady_clock::time_point> queuedAt;
+        vector<bool*> waiters;
+        for (size_t i = 0; i < count; i++) {
+            batch.insert(batch.end(), pending.front().bytes.begin(), pending.front().bytes.end());
+            queuedAt.push_back(pending.front().queuedAt);
+            waiters.push_back(pending.front().failed);
+            pending.pop_front();
+        }
+        uint64_t batchEnd = queuedSeq - pending.size();
+
+        bool writable = !broken;
+        guard.unlock();
+        bool ok = writable && fwrite(batch.data(), 1, batch.size(), file) == batch.size() &&
+                  fflush(file) == 0 && syncFile(file);
+        bool truncated = ok || !writable || truncateTo(fileEnd);
+        auto now = chrono::steady_clock::now();
+        guard.lock();
+
+        if (!truncated) {
+            cerr << "Error truncating transaction log " << filename << "; refusing further writes.\n";
+            broken = true;
+        }
+        if (ok) {
+            fileEnd += batch.size();
+        } else {
+            cerr << "Error writing transaction log " << filename << ".\n";
+            for (bool* failed : waiters) {
+                *failed = true;
+            }
+        }
+        settledSeq = batchEnd;
+        stats.batches++;
+        stats.records += count;
+        stats.largestBatch = max<uint64_t>(stats.largestBatch, count);
+        for (const auto& queued : queuedAt) {
+            double micros = chrono::duration<double, micro>(now - queued).count();
+            stats.totalCommitMicros += micros;
+            stats.maxCommitMicros = max(stats.maxCommitMicros, micros);
+        }
+        flushing = false;
+        batchChanged.notify_all();
+    }
+
+    // Opens the log file unbuffered, so a failed batch leaves nothing in a
+    // stdio buffer to be written after it is cut off, and notes its size
+    bool reopen(const char* mode) {
+        file = fopen(filename.c_str(), mode);
+        broken = false;
+        if (!file) {
+            return false;
+        }
+        setvbuf(file, nullptr, _IONBF, 0);
+        fseek(file, 0, SEEK_END);
+        fileEnd = ftell(file);
+        return true;
+    }
+
+    // Waits for any in-flight batch so the file can be swapped safely
+    void waitForIdle(unique_lock<mutex>& guard) {
+        batchChanged.wait(guard, [this] { return !flushing && pending.empty(); });
+    }
+
+public:
+    ~TransactionLog() { close(); }
+
+    bool open(string name) {
+        close();
+        lock_guard<mutex> guard(lock);
+        filename = name;
+        return reopen("ab");
+    }
+
+    void close() {
+        unique_lock<mutex> guard(lock);
+        waitForIdle(guard);
+        if (file) {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    bool isOpen() {
+        lock_guard<mutex> guard(lock);
+        return file != nullptr;
+    }
+
+    // Sets the largest number of records written by one fsync and how long
+    // a leader waits for a batch to fill before writing a partial one
+    void setGroupCommit(size_t maxRecords, chrono::microseconds maxWait) {
+        lock_guard<mutex> guard(lock);
+        maxBatchRecords = max<size_t>(maxRecords, 1);
+        maxBatchWait = maxWait;
+    }
+
+    LogStats getStats() {
+        lock_guard<mutex> guard(lock);
+        return stats;
+    }
+
+    void printStats() {
+        LogStats s = getStats();
+        cout << "Log batches: " << s.batches << ", records: " << s.records
+             << ", avg batch: " << fixed << setprecision(2)
+             << (s.batches ? double(s.records) / s.batches : 0.0)
+             << ", largest batch: " << s.largestBatch << "\n";
+        cout << "Commit latency avg: " << fixed << setprecision(1)
+             << (s.records ? s.totalCommitMicros / s.records : 0.0)
+             << "us, max: " << s.maxCommitMicros << "us\n";
+    }
+
+    // Name the log is moved to while a checkpoint covering it is written
+    static string rotatedName(const string& name) {
+        return name + ".old";
+    }
+
+    // Moves the records written so far aside and starts an empty log. If
+    // an earlier rotated log is still there (its checkpoint failed), the
+    // records are appended to it instead so none are lost.
+    void rotate() {
+        unique_lock<mutex> guard(lock);
+        waitForIdle(guard);
+        if (!file) {
+            return;
+        }
+        fclose(file);
+        file = nullptr;
+
+        string rotated = rotatedName(filename);
+        if (ifstream(rotated).good()) {
+            // The live log is only emptied once its records are durable in
+            // the rotated one; otherwise it keeps them and grows
+            if (appendDurably(filename, rotated)) {
+                reopen("wb");
+            } else {
+                reopen("ab");
+                cerr << "Error moving transaction log records to " << rotated << "; keeping them in "
+                     << filename << ".\n";
+            }
+        } else if (rename(filename.c_str(), rotated.c_str()) == 0) {
+            reopen("ab");
+        } else {
+            reopen("ab");
+            cerr << "Error rotating transaction log " << filename << ".\n";
+        }
+        if (!file) {
+            cerr << "Error reopening transaction log " << filename << ".\n";
+        }
+    }
+
+    // Deletes the rotated log once a checkpoint covers its records
+    void discardRotated() {
+        lock_guard<mutex> guard(lock);
+        if (!filename.empty()) {
+            remove(rotatedName(filename).c_str());
+        }
+    }
+
+    void logCreate(const string& accNum, const string& name, const string& pin,
+                   AccountType type, Money balance) {
+        vector<char> payload;
+        putValue<uint8_t>(payload, LOG_CREATE | LOG_CENTS);
+        putString(payload, accNum);
+        putString(payload, name);
+        putString(payload, pin);
+        putValue<uint32_t>(payload, type);
+        putValue<int64_t>(payload, balance.toCents());
+        append(payload);
+    }
+
+    void logTransaction(uint64_t accountId, const Transaction& t) {
+        vector<char> payload;
+        putValue<uint8_t>(payload, LOG_TRANSACTION | LOG_CENTS);
+        putAccountNumber(payload, accountId);
+        putValue<int64_t>(payload, t.timestamp);
+        putValue<int64_t>(payload, t.amount.toCents());
+        putValue<int64_t>(payload, t.balanceAfter.toCents());
+        putTransactionText(payload, t);
+        append(payload);
+    }
+
+    void logPinChange(const string& accNum, const string& pin) {
+        vector<char> payload;
+        putValue<uint8_t>(payload, LOG_PIN);
+        putString(payload, accNum);
+        putString(payload, pin);
+        append(payload);
+    }
+
+    void logClose(const string& accNum) {
+        vector<char> payload;
+        putValue<uint8_t>(payload, LOG_CLOSE);
+        putString(payload, accNum);
+        append(payload);
+    }
+
+    // Reads every complete record in the log and passes each payload to
+    // the handler. A torn or corrupt record (crash mid-append) ends the
+    // replay. Returns the number of records read.
+    template <typename Handler>
+    static size_t replay(string name, Handler handler) {
+        ifstream in(name, ios::binary);
+        if (!in.is_open()) {
+            return 0;
+        }
+        size_t count = 0;
+        vector<char> payload;
+        uint32_t length, checksum = 0;
+        while (in.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+            bool checksummed = (length & LOG_CHECKSUMMED) != 0;
+            length &= ~LOG_CHECKSUMMED;
+            if (checksummed && !in.read(reinterpret_cast<char*>(&checksum), sizeof(checksum))) {
+                cerr << "Ignoring incomplete record at the end of " << name << ".\n";
+                break;
+            }
+            payload.resize(length);
+            if (!in.read(payload.data(), length)) {
+                cerr << "Ignoring incomplete record at the end of " << name << ".\n";
+                break;
+            }
+            if (checksummed && crc32c(payload.data(), payload.size()) != checksum) {
+                cerr << "Ignoring corrupt record " << count + 1 << " and the rest of " << name << ".\n";
+                break;
+            }
+            ByteReader reader(payload.data(), payload.size());
+            if (!handler(reader)) {
+                cerr << "Ignoring malformed record in " << name << ".\n";
+                break;
+            }
+            count++;
+        }
+        return count;
+    }
+};
+
+// Transaction history segment files
+const uint64_t HISTORY_SEGMENT_BYTES = 4 << 20; // segments are sealed at 4 MiB
+const size_t HISTORY_INDEX_CACHE = 8;           // sealed segment indexes kept in memory
+const size_t RECENT_TRANSACTIONS = 8;           // transactions each account keeps in RAM
+const int HISTORY_RETENTION_DAYS = 90;           // full detail kept for this long
+const int HISTORY_SUMMARY_MONTHS = 12;           // monthly summaries kept before folding into an opening balance
+const size_t COMPACTION_BYTES_PER_SEC = 8 << 20; // I/O budget for background compaction
+
+// Set in a history record's length when its amounts are int64 cents;
+// segments written before that carry doubles
+const uint32_t HISTORY_RECORD_CENTS = 0x80000000u;
+
+// Per-segment index: account id -> offsets of its records, in order
+typedef map<uint64_t, vector<uint64_t>> SegmentIndex;
+
+// Starts an index file keyed by account id; older index files have no
+// header and are keyed by account number text
+const char HISTORY_INDEX_MAGIC[8] = {'B', 'M', 'S', 'I', 'D', 'X', '2', '\0'};
+
+// Name of a history segment or index file, e.g. bank_history.000001.seg
+string historyFileName(const string& prefix, uint32_t number, const string& extension) {
+    ostringstream path;
+    path << prefix << "." << setw(6) << setfill('0') << number << extension;
+    return path.str();
+}
+
+// Outcome of a history compaction pass
+struct CompactionStats {
+    uint32_t segmentsIn = 0;
+    uint32_t segmentsOut = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint64_t recordsIn = 0;
+    uint64_t recordsOut = 0;
+};
+
+// Sleeps as needed to keep a background job under a bytes/second budget
+class IoThrottle {
+private:
+    size_t bytesPerSecond;
+    uint64_t bytes = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+public:
+    IoThrottle(size_t bytesPerSecond) : bytesPerSecond(bytesPerSecond) {}
+
+    void consume(uint64_t count) {
+        bytes += count;
+        if (bytesPerSecond == 0) {
+            return;
+        }
+        auto due = start + chrono::duration_cast<chrono::steady_clock::duration>(
+                               chrono::duration<double>(double(bytes) / bytesPerSecond));
+        this_thread::sleep_until(due);
+    }
+};
+
+// Cold history archive blocks. A block holds one account's transactions
+// column by column: timestamps as deltas, transaction types as runs,
+// amounts and balances as whole cents (balances as the difference from
+// previous balance + amount, usually zero), and descriptions as indexes
+// into a per-block dictionary. All integers are varints. Blocks from
+// before amounts were held in cents may also escape a value that is not
+// a whole number of cents and store it as a raw double. On disk a block
+// is framed as uint32 stored length, uint8 method, uint32 raw length,
+// then the (compressed) bytes.
+const uint8_t ARCHIVE_RAW = 0;
+const uint8_t ARCHIVE_LZ = 1;
+const size_t ARCHIVE_FRAME_HEADER = sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t);
+
+// True if value is an exact number of cents, which are returned in `cents`
+bool toCents(double value, int64_t& cents) {
+    if (!(fabs(value) < 9e15)) {
+        return false;
+    }
+    cents = llround(value * 100);
+    return cents / 100.0 == value;
+}
+
+// Writes an amount as varint(zigzag(cents - base) << 1), or a set low bit
+// followed by the raw double when it is not whole cents
+void putCents(vector<char>& out, double value, int64_t base, bool& exact, int64_t& cents) {
+    exact = toCents(value, cents);
+    if (exact) {
+        putVarint(out, zigzag(cents - base) << 1);
+    } else {
+        putVarint(out, 1);
+        putValue(out, value);
+    }
+}
+
+bool getCents(ByteReader& reader, int64_t base, double& value, bool& exact, int64_t& cents) {
+    uint64_t code;
+    if (!reader.getVarint(code)) {
+        return false;
+    }
+    if (code & 1) {
+        if (!reader.get(value)) {
+            return false;
+        }
+        exact = toCents(value, cents);
+    } else {
+        cents = base + unzigzag(code >> 1);
+        value = cents / 100.0;
+        exact = true;
+    }
+    return true;
+}
+
+// Money is always whole cents, so it is never escaped; the raw double form
+// is only read back from blocks written when balances were doubles
+void putCents(vector<char>& out, Money value, int64_t base, bool& exact, int64_t& cents) {
+    cents = value.toCents();
+    exact = true;
+    putVarint(out, zigzag(cents - base) << 1);
+}
+
+bool getCents(ByteReader& reader, int64_t base, Money& value, bool& exact, int64_t& cents) {
+    double raw;
+    if (!getCents(reader, base, raw, exact, cents)) {
+        return false;
+    }
+    value = exact ? Money::fromCents(cents) : Money::fromDouble(raw);
+    return true;
+}
+
+vector<char> encodeArchiveBlock(uint64_t accountId, const vector<Transaction>& rows) {
+    vector<char> raw;
+    char accNum[24] = {'A', 'C', 'C', 'T'};
+    size_t length = to_chars(accNum + 4, accNum + sizeof(accNum), accountId).ptr - accNum;
+    putVarint(raw, length);
+    raw.insert(raw.end(), accNum, accNum + length);
+    putVarint(raw, rows.size());
+
+    int64_t previousTime = 0;
+    for (const Transaction& t : rows) {
+        putVarint(raw, zigzag(int64_t(t.timestamp) - previousTime));
+        previousTime = t.timestamp;
+    }
+    for (size_t i = 0; i < rows.size();) {
+        size_t run = 1;
+        while (i + run < rows.size() && transactionType(rows[i + run]) == transactionType(rows[i])) {
+            run++;
+        }
+        putVarint(raw, run);
+        raw.push_back(static_cast<char>(transactionType(rows[i])));
+        i += run;
+    }
+    vector<bool> amountExact(rows.size());
+    vector<int64_t> amountCents(rows.size());
+    for (size_t i = 0; i < rows.size(); i++) {
+        bool exact;
+        putCents(raw, rows[i].amount, 0, exact, amountCents[i]);
+        amountExact[i] = exact;
+    }
+    int64_t previousBalance = 0;
+    for (size_t i = 0; i < rows.size(); i++) {
+        int64_t base = previousBalance + (amountExact[i] ? amountCents[i] : 0);
+        bool exact;
+        int64_t cents;
+        putCents(raw, rows[i].balanceAfter, base, exact, cents);
+        previousBalance = exact ? cents : 0;
+    }
+
+    map<string, uint32_t> dictionary;
+    vector<string> texts;
+    vector<const string*> words;
+    texts.reserve(rows.size());
+    for (const Transaction& t : rows) {
+        texts.push_back(transactionText(t));
+        auto entry = dictionary.emplace(texts.back(), words.size());
+        if (entry.second) {
+            words.push_back(&entry.first->first);
+        }
+    }
+    putVarint(raw, words.size());
+    for (const string* word : words) {
+        putVarint(raw, word->size());
+        raw.insert(raw.end(), word->begin(), word->end());
+    }
+    for (const string& text : texts) {
+        putVarint(raw, dictionary[text]);
+    }
+
+    vector<char> compressed = lzCompress(raw);
+    bool useLz = compressed.size() < raw.size();
+    const vector<char>& stored = useLz ? compressed : raw;
+    vector<char> frame;
+    frame.reserve(ARCHIVE_FRAME_HEADER + stored.size());
+    putValue<uint32_t>(frame, stored.size());
+    putValue<uint8_t>(frame, useLz ? ARCHIVE_LZ : ARCHIVE_RAW);
+    putValue<uint32_t>(frame, raw.size());
+    frame.insert(frame.end(), stored.begin(), stored.end());
+    return frame;
+}
+
+// Decodes the raw (decompressed) bytes of one archive block
+bool decodeArchiveBlock(const char* data, size_t size, uint64_t& accountId, vector<Transaction>& rows) {
+    ByteReader reader(data, size);
+    uint64_t length, count;
+    const char* name;
+    if (!reader.getVarint(length) || !(name = reader.take(length)) ||
+        !parseAccountNumber(string_view(name, length), accountId) ||
+        !reader.getVarint(count) || count > size) {
+        return false;
+    }
+    rows.assign(count, Transaction());
+
+    int64_t time = 0;
+    for (Transaction& t : rows) {
+        uint64_t delta;
+        if (!reader.getVarint(delta)) {
+            return false;
+        }
+        time += unzigzag(delta);
+        t.timestamp = time;
+    }
+    for (size_t i = 0; i < rows.size();) {
+        // Types follow from the amounts, so runs are only checked
+        uint64_t run;
+        uint8_t type;
+        if (!reader.getVarint(run) || run == 0 || run > rows.size() - i ||
+            !reader.get(type) || type > TRANSFER) {
+            return false;
+        }
+        i += run;
+    }
+    vector<bool> amountExact(rows.size());
+    vector<int64_t> amountCents(rows.size());
+    for (size_t i = 0; i < rows.size(); i++) {
+        bool exact;
+        if (!getCents(reader, 0, rows[i].amount, exact, amountCents[i])) {
+            return false;
+        }
+        amountExact[i] = exact;
+    }
+    int64_t previousBalance = 0;
+    for (size_t i = 0; i < rows.size(); i++) {
+        int64_t base = previousBalance + (amountExact[i] ? amountCents[i] : 0);
+        bool exact;
+        int64_t cents;
+        if (!getCents(reader, base, rows[i].balanceAfter, exact, cents)) {
+            return false;
+        }
+        previousBalance = exact ? cents : 0;
+    }
+
+    uint64_t wordCount;
+    if (!reader.getVarint(wordCount) || wordCount > size) {
+        return false;
+    }
+    // Each distinct text is parsed once into a kind and counterparty
+    vector<Transaction> words(wordCount);
+    for (Transaction& word : words) {
+        const char* bytes;
+        if (!reader.getVarint(length) || !(bytes = reader.take(length))) {
+            return false;
+        }
+        parseTransactionText(string_view(bytes, length), word);
+    }
+    for (Transaction& t : rows) {
+        uint64_t word;
+        if (!reader.getVarint(word) || word >= words.size()) {
+            return false;
+        }
+        t.kind = words[word].kind;
+        t.counterparty = words[word].counterparty;
+    }
+    return reader.remaining() == 0;
+}
+
+// Streams the blocks of an archive file, starting at a block offset
+class ArchiveReader {
+private:
+    ifstream in;
+    vector<char> stored;
+    vector<char> raw;
+    uint64_t bytes = 0;
+
+public:
+    ArchiveReader(const string& path, uint64_t offset = 0) : in(path, ios::binary) {
+        in.seekg(offset);
+    }
+
+    bool isOpen() const { return in.is_open(); }
+
+    uint64_t bytesRead() const { return bytes; }
+
+    // Reads the next block; false at the end of the file or on a bad block
+    bool next(uint64_t& accountId, vector<Transaction>& rows) {
+        char header[ARCHIVE_FRAME_HEADER];
+        if (!in.read(header, sizeof(header))) {
+            return false;
+        }
+        ByteReader frame(header, sizeof(header));
+        uint32_t storedLength, rawLength;
+        uint8_t method;
+        frame.get(storedLength);
+        frame.get(method);
+        frame.get(rawLength);
+        stored.resize(storedLength);
+        if (!in.read(stored.data(), storedLength)) {
+            return false;
+        }
+        bytes += sizeof(header) + storedLength;
+        if (method == ARCHIVE_LZ) {
+            if (!lzDecompress(stored.data(), stored.size(), rawLength, raw)) {
+                return false;
+            }
+            return decodeArchiveBlock(raw.data(), raw.size(), accountId, rows);
+        }
+        return method == ARCHIVE_RAW && rawLength == storedLength &&
+               decodeArchiveBlock(stored.data(), stored.size(), accountId, rows);
+    }
+};
+
+// Persistent transaction history split into fixed-size, append-only
+// segment files (<prefix>.000001.seg, ...). Each record is a uint32
+// length followed by the account number and transaction. When a segment
+// fills up it is sealed and its account index is written beside it
+// (<prefix>.000001.idx), so a statement only reads the index and the
+// records of the segments that hold the account's recent history.
+//
+// Sealed segments are archived: the raw records are re-encoded as one
+// archive block per account (<prefix>.000001.arc) and the index points
+// at each account's block instead of its individual records.
+//
+// compact() rewrites the oldest sealed segments, folding transactions
+// past the retention horizon into per-account monthly summaries and,
+// further back, a single opening balance. The rewritten segments take
+// the highest numbers of the range they replace and <prefix>.manifest
+// records the first live segment number.
+class HistoryStore {
+private:
+    string prefix;
+    FILE* active = nullptr;
+    uint32_t firstNumber = 1;
+    uint32_t activeNumber = 0;
+    uint64_t activeSize = 0;
+    SegmentIndex activeIndex;
+    map<uint32_t, SegmentIndex> indexCache;
+    deque<pair<uint64_t, Transaction>> unwritten; // appends waiting for a writable segment
+    deque<uint32_t> toArchive;                  // sealed segments not archived yet, oldest first
+    bool stopArchiving = false;
+    mutex lock;
+    condition_variable archiveChanged;
+    thread archiver;
+
+    string segmentPath(uint32_t number) const {
+        return historyFileName(prefix, number, ".seg");
+    }
+
+    string indexPath(uint32_t number) const {
+        return historyFileName(prefix, number, ".idx");
+    }
+
+    string archivePath(uint32_t number) const {
+        return historyFileName(prefix, number, ".arc");
+    }
+
+    static bool fileExists(const string& path) {
+        return ifstream(path).good();
+    }
+
+    static void encode(vector<char>& payload, uint64_t accountId, const Transaction& t) {
+        putAccountNumber(payload, accountId);
+        putValue<int64_t>(payload, t.timestamp);
+        putValue<uint8_t>(payload, transactionType(t));
+        putValue<int64_t>(payload, t.amount.toCents());
+        putValue<int64_t>(payload, t.balanceAfter.toCents());
+        putTransactionText(payload, t);
+    }
+
+    static bool decode(ByteReader& reader, bool cents, uint64_t& accountId, Transaction& t) {
+        int64_t timestamp;
+        uint8_t type;
+        string_view accNum, text;
+        if (!reader.getStringView(accNum) || !parseAccountNumber(accNum, accountId) ||
+            !reader.get(timestamp) || !reader.get(type) ||
+            !reader.getMoney(t.amount, cents) || !reader.getMoney(t.balanceAfter, cents) ||
+            !reader.getStringView(text) || type > TRANSFER) {
+            return false;
+        }
+        t.timestamp = timestamp;
+        parseTransactionText(text, t);
+        return true;
+    }
+
+    // Rebuilds a segment's index by reading it front to back; used for
+    // the active segment, which has no index file yet
+    SegmentIndex scanSegment(uint32_t number, uint64_t& validSize) {
+        SegmentIndex index;
+        ifstream in(segmentPath(number), ios::binary);
+        vector<char> payload;
+        uint32_t length;
+        validSize = 0;
+        while (in.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+            bool cents = length & HISTORY_RECORD_CENTS;
+            length &= ~HISTORY_RECORD_CENTS;
+            payload.resize(length);
+            if (!in.read(payload.data(), length)) {
+                break;
+            }
+            ByteReader reader(payload.data(), payload.size());
+            uint64_t accountId;
+            Transaction t;
+            if (!decode(reader, cents, accountId, t)) {
+                break;
+            }
+            index[accountId].push_back(validSize);
+            validSize += sizeof(length) + length;
+        }
+        return index;
+    }
+
+    static vector<char> encodeIndex(const SegmentIndex& index) {
+        vector<char> data(HISTORY_INDEX_MAGIC, HISTORY_INDEX_MAGIC + sizeof(HISTORY_INDEX_MAGIC));
+        for (const auto& entry : index) {
+            putValue(data, entry.first);
+            putValue<uint32_t>(data, entry.second.size());
+            for (uint64_t offset : entry.second) {
+                putValue(data, offset);
+            }
+        }
+        return data;
+    }
+
+    void writeIndex(uint32_t number, const SegmentIndex& index) {
+        vector<char> data = encodeIndex(index);
+        ofstream out(indexPath(number), ios::binary | ios::trunc);
+        out.write(data.data(), data.size());
+    }
+
+    string manifestPath() const {
+        return prefix + ".manifest";
+    }
+
+    // The manifest holds the first live segment and, while a compaction is
+    // being installed, the range its rewritten segments replace
+    bool writeManifest(uint32_t first, uint32_t pendingFirst = 0, uint32_t pendingLast = 0) {
+        string text = "first " + to_string(first) + "\n";
+        if (pendingFirst != 0) {
+            text += "pending " + to_string(pendingFirst) + " " + to_string(pendingLast) + "\n";
+        }
+        string tempFile = manifestPath() + ".tmp";
+        if (!writeFileDurably(tempFile, vector<char>(text.begin(), text.end())) ||
+            !replaceFileAtomically(tempFile, manifestPath())) {
+            cerr << "Error writing history manifest " << manifestPath() << ".\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Moves rewritten segments over the range they replace and deletes
+    // the segments before it. Safe to repeat after a crash part way.
+    void installCompaction(uint32_t newFirst, uint32_t last) {
+        for (uint32_t number = newFirst; number <= last; number++) {
+            for (string path : {archivePath(number), indexPath(number)}) {
+                string compacted = path + ".compact";
+                if (fileExists(compacted)) {
+                    remove(path.c_str());
+                    rename(compacted.c_str(), path.c_str());
+                }
+            }
+            remove(segmentPath(number).c_str());
+        }
+        for (uint32_t number = firstNumber; number < newFirst; number++) {
+            remove(segmentPath(number).c_str());
+            remove(archivePath(number).c_str());
+            remove(indexPath(number).c_str());
+        }
+        firstNumber = newFirst;
+        writeManifest(firstNumber);
+        indexCache.clear();
+    }
+
+    // Calls handler(accountId, transaction) for every record of a
+    // segment, in order. Returns the number of bytes read.
+    template <typename Handler>
+    uint64_t readSegment(uint32_t number, Handler handler) {
+        ArchiveReader archive(archivePath(number));
+        if (archive.isOpen()) {
+            uint64_t accountId;
+            vector<Transaction> rows;
+            while (archive.next(accountId, rows)) {
+                for (const Transaction& t : rows) {
+                    handler(accountId, t);
+                }
+            }
+            return archive.bytesRead();
+        }
+
+        ifstream in(segmentPath(number), ios::binary);
+        vector<char> payload;
+        uint32_t length;
+        uint64_t bytes = 0;
+        while (in.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+            bool cents = length & HISTORY_RECORD_CENTS;
+            length &= ~HISTORY_RECORD_CENTS;
+            payload.resize(length);
+            if (!in.read(payload.data(), length)) {
+                break;
+            }
+            ByteReader reader(payload.data(), payload.size());
+            uint64_t accountId;
+            Transaction t;
+            if (decode(reader, cents, accountId, t)) {
+                handler(accountId, t);
+            }
+            bytes += sizeof(length) + length;
+        }
+        return bytes;
+    }
+
+    // Months since year 0, in local time
+    static int monthOf(time_t timestamp) {
+        tm local = localTime(timestamp);
+        return (local.tm_year + 1900) * 12 + local.tm_mon;
+    }
+
+    // Loads a sealed segment's index, keeping a few of them cached
+    const SegmentIndex* loadIndex(uint32_t number) {
+        auto cached = indexCache.find(number);
+        if (cached != indexCache.end()) {
+            return &cached->second;
+        }
+
+        ifstream in(indexPath(number), ios::binary);
+        if (!in.is_open()) {
+            return nullptr;
+        }
+        vector<char> data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        bool keyedById = data.size() >= sizeof(HISTORY_INDEX_MAGIC) &&
+                         memcmp(data.data(), HISTORY_INDEX_MAGIC, sizeof(HISTORY_INDEX_MAGIC)) == 0;
+        ByteReader reader(data.data(), data.size());
+        if (keyedById) {
+            reader.take(sizeof(HISTORY_INDEX_MAGIC));
+        }
+        SegmentIndex index;
+        uint64_t accountId;
+        string_view accNum;
+        uint32_t count;
+        while (reader.remaining() > 0) {
+            bool keyRead = keyedById ? reader.get(accountId)
+                                     : reader.getStringView(accNum) && parseAccountNumber(accNum, accountId);
+            if (!keyRead || !reader.get(count) || reader.remaining() / sizeof(uint64_t) < count) {
+                cerr << "History index " << indexPath(number) << " is corrupt.\n";
+                return nullptr;
+            }
+            vector<uint64_t>& offsets = index[accountId];
+            offsets.resize(count);
+            for (uint32_t i = 0; i < count; i++) {
+                reader.get(offsets[i]);
+            }
+        }
+
+        if (indexCache.size() >= HISTORY_INDEX_CACHE) {
+            indexCache.erase(indexCache.begin());
+        }
+        return &(indexCache[number] = move(index));
+    }
+
+    // Encodes grouped per-account transactions as archive blocks, filling
+    // in each account's block offset in `index`
+    static vector<char> encodeArchive(const map<uint64_t, vector<Transaction>>& accounts,
+                                      SegmentIndex& index) {
+        vector<char> data;
+        for (const auto& entry : accounts) {
+            index[entry.first].assign(1, data.size());
+            vector<char> block = encodeArchiveBlock(entry.first, entry.second);
+            data.insert(data.end(), block.begin(), block.end());
+        }
+        return data;
+    }
+
+    // Replaces a sealed segment with its archive. Runs on the archiver
+    // thread: a sealed segment never changes, so it is read, encoded and
+    // written without the lock, which is only taken to swap the archive
+    // and its index in together. If the archive cannot be written the raw
+    // segment stays, made durable, under the index written when it was
+    // sealed.
+    void archiveSegment(uint32_t number) {
+        map<uint64_t, vector<Transaction>> accounts;
+        readSegment(number, [&](uint64_t accountId, const Transaction& t) {
+            accounts[accountId].push_back(t);
+        });
+        SegmentIndex index;
+        vector<char> data = encodeArchive(accounts, index);
+        string archiveTemp = archivePath(number) + ".tmp", indexTemp = indexPath(number) + ".tmp";
+        if (!writeFileDurably(archiveTemp, data) || !writeFileDurably(indexTemp, encodeIndex(index))) {
+            remove(archiveTemp.c_str());
+            remove(indexTemp.c_str());
+            FILE* segment = fopen(segmentPath(number).c_str(), "rb");
+            if (!segment || !syncFile(segment)) {
+                cerr << "Error syncing history segment " << segmentPath(number) << ".\n";
+            }
+            if (segment) {
+                fclose(segment);
+            }
+            return;
+        }
+
+        // The archive goes in before its index; open() sorts out a crash
+        // between the two because the raw segment is still there
+        {
+            lock_guard<mutex> guard(lock);
+            rename(archiveTemp.c_str(), archivePath(number).c_str());
+            rename(indexTemp.c_str(), indexPath(number).c_str());
+            indexCache.erase(number);
+            remove(segmentPath(number).c_str());
+        }
+        syncDirectoryOf(segmentPath(number));
+    }
+
+    // Archives sealed segments as they are queued, until close() asks it
+    // to stop and the queue is empty. A segment leaves the queue only once
+    // it is archived, so compaction never picks one up half way.
+    void archiveQueued() {
+        unique_lock<mutex> guard(lock);
+        while (true) {
+            archiveChanged.wait(guard, [this] { return stopArchiving || !toArchive.empty(); });
+            if (toArchive.empty()) {
+                return;
+            }
+            uint32_t number = toArchive.front();
+            guard.unlock();
+            archiveSegment(number);
+            guard.lock();
+            toArchive.pop_front();
+            archiveChanged.notify_all();
+        }
+    }
+
+    // Opens the active segment for appending, unbuffered so a failed
+    // write can be cut off without stdio writing it out later
+    bool openActive() {
+        active = fopen(segmentPath(activeNumber).c_str(), "ab");
+        if (active) {
+            setvbuf(active, nullptr, _IONBF, 0);
+        }
+        return active != nullptr;
+    }
+
+    // Closes the active segment and indexes it as it stands, which marks it
+    // sealed; archiving it is left to the archiver thread
+    void sealActive() {
+        fclose(active);
+        active = nullptr;
+        writeIndex(activeNumber, activeIndex);
+        toArchive.push_back(activeNumber);
+        archiveChanged.notify_all();
+        activeIndex.clear();
+        activeNumber++;
+        activeSize = 0;
+        if (!openActive()) {
+            cerr << "Error creating history segment " << segmentPath(activeNumber) << ".\n";
+        }
+    }
+
+    // Appends one record to the active segment, reopening it if an earlier
+    // failure closed it. A failed write is cut off the end of the segment.
+    bool write(uint64_t accountId, const Transaction& t) {
+        vector<char> record;
+        putValue<uint32_t>(record, 0);
+        encode(record, accountId, t);
+        uint32_t length = (record.size() - sizeof(uint32_t)) | HISTORY_RECORD_CENTS;
+        memcpy(record.data(), &length, sizeof(length));
+
+        if (!active && !openActive()) {
+            return false;
+        }
+        if (activeSize > 0 && activeSize + record.size() > HISTORY_SEGMENT_BYTES) {
+            sealActive();
+            if (!active) {
+                return false;
+            }
+        }
+        if (fwrite(record.data(), 1, record.size(), active) != record.size() || fflush(active) != 0) {
+            if (!truncateFile(active, activeSize)) {
+                fclose(active);
+                active = nullptr;
+            }
+            return false;
+        }
+        activeIndex[accountId].push_back(activeSize);
+        activeSize += record.size();
+        return true;
+    }
+
+    // Reads the records at the given offsets of one segment, newest first,
+    // until `out` holds `count` transactions
+    void readRecords(uint32_t number, const vector<uint64_t>& offsets, size_t count,
+                     vector<Transaction>& out) {
+        ArchiveReader archive(archivePath(number), offsets.empty() ? 0 : offsets.front());
+        if (archive.isOpen()) {
+            uint64_t accountId;
+            vector<Transaction> rows;
+            if (archive.next(accountId, rows)) {
+                for (auto it = rows.rbegin(); it != rows.rend() && out.size() < count; ++it) {
+                    out.push_back(move(*it));
+                }
+            }
+            return;
+        }
+
+        ifstream in(segmentPath(number), ios::binary);
+        vector<char> payload;
+        for (auto it = offsets.rbegin(); it != offsets.rend() && out.size() < count; ++it) {
+            uint32_t length;
+            in.seekg(*it);
+            if (!in.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+                return;
+            }
+            bool cents = length & HISTORY_RECORD_CENTS;
+            length &= ~HISTORY_RECORD_CENTS;
+            payload.resize(length);
+            if (!in.read(payload.data(), length)) {
+                return;
+            }
+            ByteReader reader(payload.data(), payload.size());
+            uint64_t accountId;
+            Transaction t;
+            if (decode(reader, cents, accountId, t)) {
+                out.push_back(t);
+            }
+        }
+    }
+
+public:
+    ~HistoryStore() { close(); }
+
+    bool open(string name) {
+        close();
+        lock_guard<mutex> guard(lock);
+        prefix = name;
+
+        // Segments are numbered from the manifest's first live segment; the
+        // first without an index is active
+        firstNumber = 1;
+        ifstream manifest(manifestPath());
+        string key;
+        uint32_t pendingFirst = 0, pendingLast = 0;
+        while (manifest >> key) {
+            if (key == "first") {
+                manifest >> firstNumber;
+            } else if (key == "pending") {
+                manifest >> pendingFirst >> pendingLast;
+            }
+        }
+        manifest.close();
+        if (pendingFirst != 0) {
+            installCompaction(pendingFirst, pendingLast);
+        }
+
+        // A sealed segment still present raw was not archived yet. If an
+        // archive is there too, a crash cut its install short and the
+        // index may belong to either, so the archive is dropped, the raw
+        // index rebuilt and the segment archived again.
+        activeNumber = firstNumber;
+        toArchive.clear();
+        while (fileExists(indexPath(activeNumber))) {
+            remove((archivePath(activeNumber) + ".tmp").c_str());
+            remove((indexPath(activeNumber) + ".tmp").c_str());
+            if (fileExists(segmentPath(activeNumber))) {
+                if (fileExists(archivePath(activeNumber))) {
+                    remove(archivePath(activeNumber).c_str());
+                    uint64_t size;
+                    writeIndex(activeNumber, scanSegment(activeNumber, size));
+                }
+                toArchive.push_back(activeNumber);
+            }
+            activeNumber++;
+        }
+        remove(archivePath(activeNumber).c_str()); // crashed before the index was written
+        activeIndex = scanSegment(activeNumber, activeSize);
+        if (fileExists(segmentPath(activeNumber))) {
+            // Drop anything torn off the end by a crash mid-append
+            ifstream in(segmentPath(activeNumber), ios::binary | ios::ate);
+            if (static_cast<uint64_t>(in.tellg()) != activeSize) {
+                in.close();
+                vector<char> valid(activeSize);
+                ifstream(segmentPath(activeNumber), ios::binary).read(valid.data(), activeSize);
+                ofstream(segmentPath(activeNumber), ios::binary | ios::trunc).write(valid.data(), activeSize);
+            }
+        }
+        unwritten.clear();
+        stopArchiving = false;
+        archiver = thread([this] { archiveQueued(); });
+        return openActive();
+    }
+
+    // Finishes archiving whatever has been sealed, then closes the files
+    void close() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopArchiving = true;
+            archiveChanged.notify_all();
+        }
+        if (archiver.joinable()) {
+            archiver.join();
+        }
+        lock_guard<mutex> guard(lock);
+        if (active) {
+            fclose(active);
+            active = nullptr;
+        }
+        prefix.clear();
+        indexCache.clear();
+    }
+
+    bool isOpen() {
+        lock_guard<mutex> guard(lock);
+        return active != nullptr;
+    }
+
+    // Appends a transaction. If the store cannot be written it keeps the
+    // record and retries it ahead of the next append, so history is late
+    // rather than lost; pendingCount() reports how many are waiting.
+    void append(uint64_t accountId, const Transaction& t) {
+        lock_guard<mutex> guard(lock);
+        if (prefix.empty()) {
+            return;
+        }
+        bool wasFailing = !unwritten.empty();
+        unwritten.emplace_back(accountId, t);
+        while (!unwritten.empty() && write(unwritten.front().first, unwritten.front().second)) {
+            unwritten.pop_front();
+        }
+        if (!unwritten.empty() && !wasFailing) {
+            cerr << "Error writing history segment " << segmentPath(activeNumber)
+                 << "; holding transactions until it can be written.\n";
+        }
+    }
+
+    size_t pendingCount() {
+        lock_guard<mutex> guard(lock);
+        return unwritten.size();
+    }
+
+    // Forces appended records to disk, waiting for sealed segments to be
+    // archived or synced. A checkpoint calls this before it discards the
+    // log records that would otherwise rebuild them.
+    bool sync() {
+        unique_lock<mutex> guard(lock);
+        archiveChanged.wait(guard, [this] { return toArchive.empty(); });
+        return unwritten.empty() && (!active || syncFile(active));
+    }
+
+    // Returns up to `count` of the account's most recent transactions,
+    // oldest first, reading segments from newest to oldest
+    vector<Transaction> recent(uint64_t accountId, size_t count) {
+        lock_guard<mutex> guard(lock);
+        vector<Transaction> found;
+        if (active) {
+            fflush(active);
+        }
+        for (uint32_t number = activeNumber; number >= firstNumber && found.size() < count; number--) {
+            const SegmentIndex* index = number == activeNumber ? &activeIndex : loadIndex(number);
+            if (!index) {
+                continue;
+            }
+            auto entry = index->find(accountId);
+            if (entry != index->end()) {
+                readRecords(number, entry->second, count, found);
+            }
+        }
+        reverse(found.begin(), found.end());
+        return found;
+    }
+
+    // Streams every stored transaction to handler(accountId, transaction),
+    // oldest segment first, decoding archives block by block. Returns the
+    // number of bytes read.
+    template <typename Handler>
+    uint64_t forEachTransaction(Handler handler) {
+        lock_guard<mutex> guard(lock);
+        if (active) {
+            fflush(active);
+        }
+        uint64_t bytes = 0;
+        for (uint32_t number = firstNumber; number <= activeNumber; number++) {
+            bytes += readSegment(number, handler);
+        }
+        return bytes;
+    }
+
+    // Folds sealed segments whose transactions are all older than
+    // `horizon` into summary records, using at most bytesPerSecond of
+    // disk bandwidth. Runs alongside appends and statements; the store is
+    // only locked to pick the segments and to install the result.
+    CompactionStats compact(time_t horizon, size_t bytesPerSecond) {
+        CompactionStats stats;
+        uint32_t first, sealedEnd;
+        {
+            lock_guard<mutex> guard(lock);
+            if (!active) {
+                return stats;
+            }
+            first = firstNumber;
+            sealedEnd = toArchive.empty() ? activeNumber : toArchive.front();
+        }
+
+        // Per account: everything before the summary window folds into
+        // one opening record, everything else into one record per month
+        struct Fold {
+            bool hasOpening = false;
+            Transaction opening;
+            map<int, Transaction> months;
+        };
+        int summaryStart = monthOf(horizon) - HISTORY_SUMMARY_MONTHS;
+        map<uint64_t, Fold> folds;
+        auto fold = [](Transaction& into, bool fresh, const Transaction& t) {
+            into.amount = (fresh ? Money() : into.amount) + t.amount;
+            into.timestamp = t.timestamp;
+            into.balanceAfter = t.balanceAfter;
+        };
+
+        IoThrottle throttle(bytesPerSecond);
+        uint32_t last = first - 1;
+        vector<pair<uint64_t, Transaction>> records;
+        for (uint32_t number = first; number < sealedEnd; number++) {
+            records.clear();
+            bool tooRecent = false;
+            uint64_t bytes = readSegment(number, [&](uint64_t accountId, const Transaction& t) {
+                tooRecent = tooRecent || t.timestamp >= horizon;
+                records.emplace_back(accountId, t);
+            });
+            throttle.consume(bytes);
+            if (tooRecent) {
+                break;
+            }
+
+            for (const auto& record : records) {
+                Fold& f = folds[record.first];
+                int month = monthOf(record.second.timestamp);
+                if (month < summaryStart) {
+                    fold(f.opening, !f.hasOpening, record.second);
+                    f.hasOpening = true;
+                } else {
+                    auto existing = f.months.find(month);
+                    fold(f.months[month], existing == f.months.end(), record.second);
+                }
+            }
+            last = number;
+            stats.segmentsIn++;
+            stats.bytesIn += bytes;
+            stats.recordsIn += records.size();
+        }
+        if (stats.segmentsIn == 0) {
+            return stats;
+        }
+
+        // Re-encode the folded history as archives of at most the usual
+        // segment size, one block per account
+        vector<pair<vector<char>, SegmentIndex>> output(1);
+        auto emit = [&](vector<Transaction>& rows, Transaction t, TransactionKind kind) {
+            t.kind = kind;
+            t.counterparty = 0;
+            rows.push_back(t);
+            stats.recordsOut++;
+        };
+        for (const auto& entry : folds) {
+            vector<Transaction> rows;
+            if (entry.second.hasOpening) {
+                emit(rows, entry.second.opening, KIND_OPENING);
+            }
+            // A month's record carries the timestamp of its last transaction,
+            // which names the month in the summary's text
+            for (const auto& month : entry.second.months) {
+                emit(rows, month.second, KIND_SUMMARY);
+            }
+            vector<char> block = encodeArchiveBlock(entry.first, rows);
+            if (!output.back().first.empty() &&
+                output.back().first.size() + block.size() > HISTORY_SEGMENT_BYTES) {
+                output.emplace_back();
+            }
+            output.back().second[entry.first].assign(1, output.back().first.size());
+            output.back().first.insert(output.back().first.end(), block.begin(), block.end());
+        }
+
+        uint32_t segmentCount = output.size();
+        if (segmentCount > last - first + 1) {
+            return CompactionStats(); // nothing would be saved
+        }
+        uint32_t newFirst = last - segmentCount + 1;
+        auto discard = [&](uint32_t count) {
+            for (uint32_t j = 0; j < count; j++) {
+                remove((archivePath(newFirst + j) + ".compact").c_str());
+                remove((indexPath(newFirst + j) + ".compact").c_str());
+            }
+            return CompactionStats();
+        };
+        for (uint32_t i = 0; i < segmentCount; i++) {
+            vector<char> index = encodeIndex(output[i].second);
+            if (!writeFileDurably(archivePath(newFirst + i) + ".compact", output[i].first) ||
+                !writeFileDurably(indexPath(newFirst + i) + ".compact", index)) {
+                return discard(i + 1);
+            }
+            throttle.consume(output[i].first.size() + index.size());
+            stats.bytesOut += output[i].first.size();
+        }
+        stats.segmentsOut = segmentCount;
+
+        // Once the manifest names the range, open() finishes the install
+        // after a crash
+        lock_guard<mutex> guard(lock);
+        if (!writeManifest(firstNumber, newFirst, last)) {
+            return discard(segmentCount);
+        }
+        installCompaction(newFirst, last);
+        return stats;
+    }
+};
+
+// Column-oriented ledger export for analytics. Rows are written in row
+// groups of LEDGER_ROW_GROUP transactions; within a group each column is
+// stored on its own with an encoding suited to it:
+//   account, description  dictionary of distinct values + varint index
+//   timestamp             zigzag varint deltas
+//   type                  runs of (varint length, byte)
+//   amount, balance       varint whole cents, escaped raw double otherwise
+// A footer lists every group's offset, column sizes, CRC-32C and its
+// min/max timestamp and amount, so a range scan reads only the footer
+// and the groups that can hold matching rows.
+const char LEDGER_MAGIC[8] = {'B', 'M', 'S', 'L', 'E', 'D', 'G', '\0'};
+const uint32_t LEDGER_VERSION = 2; // version 1 kept the amount range as doubles
+const uint32_t LEDGER_ROW_GROUP = 65536;
+
+enum LedgerColumn { LEDGER_ACCOUNT, LEDGER_TIMESTAMP, LEDGER_TYPE, LEDGER_AMOUNT, LEDGER_BALANCE,
+                    LEDGER_DESCRIPTION, LEDGER_COLUMNS };
+
+struct LedgerRowGroup {
+    uint64_t offset;
+    uint32_t rows;
+    uint32_t checksum;
+    int64_t minTimestamp;
+    int64_t maxTimestamp;
+    int64_t minCents;
+    int64_t maxCents;
+    uint32_t columnBytes[LEDGER_COLUMNS];
+};
+
+struct LedgerTrailer {
+    uint64_t footerOffset;
+    uint32_t groupCount;
+    uint32_t version;
+    char magic[8];
+};
+
+// Dictionary-encodes one string column of a row group
+class LedgerDictionary {
+private:
+    map<string, uint32_t> ids;
+    vector<const string*> values;
+    vector<char> indexes;
+
+public:
+    void add(const string& value) {
+        auto entry = ids.emplace(value, values.size());
+        if (entry.second) {
+            values.push_back(&entry.first->first);
+        }
+        putVarint(indexes, entry.first->second);
+    }
+
+    void encode(vector<char>& out) const {
+        putVarint(out, values.size());
+        for (const string* value : values) {
+            putVarint(out, value->size());
+            out.insert(out.end(), value->begin(), value->end());
+        }
+        out.insert(out.end(), indexes.begin(), indexes.end());
+    }
+
+    void clear() {
+        ids.clear();
+        values.clear();
+        indexes.clear();
+    }
+};
+
+// Streams transactions into a ledger file, holding only the row group
+// being built in memory
+class LedgerWriter {
+private:
+    FILE* file = nullptr;
+    string filename;
+    uint64_t written = 0;
+    bool failed = false;
+    vector<LedgerRowGroup> groups;
+    LedgerRowGroup current = {};
+    LedgerDictionary accounts;
+    LedgerDictionary descriptions;
+    vector<char> columns[LEDGER_COLUMNS];
+    int64_t previousTime = 0;
+    int runType = -1;
+    uint64_t runLength = 0;
+
+    void write(const char* data, size_t size) {
+        if (!failed && fwrite(data, 1, size, file) != size) {
+            failed = true;
+        }
+        written += size;
+    }
+
+    void endRun() {
+        if (runLength > 0) {
+            putVarint(columns[LEDGER_TYPE], runLength);
+            columns[LEDGER_TYPE].push_back(static_cast<char>(runType));
+        }
+        runLength = 0;
+    }
+
+    void flushGroup() {
+        if (current.rows == 0) {
+            return;
+        }
+        endRun();
+        accounts.encode(columns[LEDGER_ACCOUNT]);
+        descriptions.encode(columns[LEDGER_DESCRIPTION]);
+
+        current.offset = written;
+        current.checksum = 0;
+        for (int c = 0; c < LEDGER_COLUMNS; c++) {
+            current.columnBytes[c] = columns[c].size();
+            current.checksum = crc32c(columns[c].data(), columns[c].size(), current.checksum);
+            write(columns[c].data(), columns[c].size());
+            columns[c].clear();
+        }
+        groups.push_back(current);
+        current = LedgerRowGroup();
+        accounts.clear();
+        descriptions.clear();
+        previousTime = 0;
+        runType = -1;
+    }
+
+public:
+    ~LedgerWriter() {
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    bool open(string name) {
+        filename = name;
+        file = fopen(filename.c_str(), "wb");
+        if (!file) {
+            cerr << "Error creating ledger " << filename << ".\n";
+            return false;
+        }
+        vector<char> header(LEDGER_MAGIC, LEDGER_MAGIC + sizeof(LEDGER_MAGIC));
+        putValue(header, LEDGER_VERSION);
+        putValue<uint32_t>(header, 0);
+        write(header.data(), header.size());
+        return true;
+    }
+
+    void add(const string& accNum, const Transaction& t) {
+        if (current.rows == 0) {
+            current.minTimestamp = current.maxTimestamp = t.timestamp;
+            current.minCents = current.maxCents = t.amount.toCents();
+        }
+        current.minTimestamp = min<int64_t>(current.minTimestamp, t.timestamp);
+        current.maxTimestamp = max<int64_t>(current.maxTimestamp, t.timestamp);
+        current.minCents = min(current.minCents, t.amount.toCents());
+        current.maxCents = max(current.maxCents, t.amount.toCents());
+
+        accounts.add(accNum);
+        putVarint(columns[LEDGER_TIMESTAMP], zigzag(int64_t(t.timestamp) - previousTime));
+        previousTime = t.timestamp;
+        if (transactionType(t) != runType) {
+            endRun();
+            runType = transactionType(t);
+        }
+        runLength++;
+        bool exact;
+        int64_t cents;
+        putCents(columns[LEDGER_AMOUNT], t.amount, 0, exact, cents);
+        putCents(columns[LEDGER_BALANCE], t.balanceAfter, 0, exact, cents);
+        descriptions.add(transactionText(t));
+
+        if (++current.rows == LEDGER_ROW_GROUP) {
+            flushGroup();
+        }
+    }
+
+    // Writes the last row group and the footer; returns false if any
+    // write failed
+    bool close() {
+        if (!file) {
+            return false;
+        }
+        flushGroup();
+        LedgerTrailer trailer = {};
+        trailer.footerOffset = written;
+        trailer.groupCount = groups.size();
+        trailer.version = LEDGER_VERSION;
+        memcpy(trailer.magic, LEDGER_MAGIC, sizeof(trailer.magic));
+        vector<char> footer;
+        for (const LedgerRowGroup& group : groups) {
+            putValue(footer, group);
+        }
+        putValue(footer, trailer);
+        write(footer.data(), footer.size());
+        bool ok = !failed && fflush(file) == 0 && syncFile(file);
+        ok = fclose(file) == 0 && ok;
+        file = nullptr;
+        if (!ok) {
+            cerr << "Error writing ledger " << filename << ".\n";
+        }
+        return ok;
+    }
+
+    uint64_t rowGroups() const { return groups.size(); }
+    uint64_t bytesWritten() const { return written; }
+};
+
+// Outcome of a ledger range scan
+struct LedgerScanStats {
+    uint32_t groupsRead = 0;
+    uint32_t groupsSkipped = 0;
+    uint64_t bytesRead = 0;
+    uint64_t rowsMatched = 0;
+};
+
+// Range scans over a ledger file; row groups whose statistics rule out
+// every row are never read
+class LedgerReader {
+private:
+    ifstream file;
+    vector<LedgerRowGroup> groups;
+
+    static bool decodeDictionary(ByteReader& reader, uint32_t rows, vector<string>& values,
+                                 vector<uint32_t>& ids) {
+        uint64_t count, length, id;
+        if (!reader.getVarint(count) || count > reader.remaining()) {
+            return false;
+        }
+        values.resize(count);
+        for (string& value : values) {
+            const char* bytes;
+            if (!reader.getVarint(length) || !(bytes = reader.take(length))) {
+                return false;
+            }
+            value.assign(bytes, length);
+        }
+        ids.resize(rows);
+        for (uint32_t& slot : ids) {
+            if (!reader.getVarint(id) || id >= count) {
+                return false;
+            }
+            slot = id;
+        }
+        return true;
+    }
+
+    bool decodeGroup(const LedgerRowGroup& group, const vector<char>& data,
+                     vector<string>& accountValues, vector<uint32_t>& accountIds,
+                     vector<string>& descriptionValues, vector<uint32_t>& descriptionIds,
+                     vector<Transaction>& rows) {
+        const char* column[LEDGER_COLUMNS];
+        const char* cursor = data.data();
+        for (int c = 0; c < LEDGER_COLUMNS; c++) {
+            column[c] = cursor;
+            cursor += group.columnBytes[c];
+        }
+        rows.resize(group.rows);
+
+        ByteReader accountsIn(column[LEDGER_ACCOUNT], group.columnBytes[LEDGER_ACCOUNT]);
+        ByteReader descriptionsIn(column[LEDGER_DESCRIPTION], group.columnBytes[LEDGER_DESCRIPTION]);
+        if (!decodeDictionary(accountsIn, group.rows, accountValues, accountIds) ||
+            !decodeDictionary(descriptionsIn, group.rows, descriptionValues, descriptionIds)) {
+            return false;
+        }
+
+        ByteReader times(column[LEDGER_TIMESTAMP], group.columnBytes[LEDGER_TIMESTAMP]);
+        ByteReader amounts(column[LEDGER_AMOUNT], group.columnBytes[LEDGER_AMOUNT]);
+        ByteReader balances(column[LEDGER_BALANCE], group.columnBytes[LEDGER_BALANCE]);
+        int64_t time = 0;
+        for (Transaction& t : rows) {
+            uint64_t delta;
+            bool exact;
+            int64_t cents;
+            if (!times.getVarint(delta) || !getCents(amounts, 0, t.amount, exact, cents) ||
+                !getCents(balances, 0, t.balanceAfter, exact, cents)) {
+                return false;
+            }
+            time += unzigzag(delta);
+            t.timestamp = time;
+        }
+
+        // Types follow from the amounts, so runs are only checked
+        ByteReader types(column[LEDGER_TYPE], group.columnBytes[LEDGER_TYPE]);
+        for (uint32_t i = 0; i < group.rows;) {
+            uint64_t run;
+            uint8_t type;
+            if (!types.getVarint(run) || run == 0 || run > group.rows - i ||
+                !types.get(type) || type > TRANSFER) {
+                return false;
+            }
+            i += run;
+        }
+        return true;
+    }
+
+    // Converts a version 1 amount bound, stored as the bits of a double,
+    // to whole cents rounded outwards so no row is skipped
+    static int64_t centsBound(int64_t bits, bool upper) {
+        double amount;
+        memcpy(&amount, &bits, sizeof(amount));
+        double scaled = upper ? ceil(amount * 100) : floor(amount * 100);
+        if (isnan(scaled)) {
+            return upper ? INT64_MAX : INT64_MIN;
+        }
+        if (fabs(scaled) >= 9.2e18) {
+            return scaled < 0 ? INT64_MIN : INT64_MAX;
+        }
+        return static_cast<int64_t>(scaled);
+    }
+
+public:
+    bool open(string filename) {
+        file.open(filename, ios::binary | ios::ate);
+        if (!file.is_open()) {
+            return false;
+        }
+        uint64_t fileSize = file.tellg();
+        LedgerTrailer trailer;
+        if (fileSize < sizeof(LEDGER_MAGIC) + 2 * sizeof(uint32_t) + sizeof(trailer)) {
+            cerr << "Ledger " << filename << " is truncated.\n";
+            return false;
+        }
+        file.seekg(fileSize - sizeof(trailer));
+        file.read(reinterpret_cast<char*>(&trailer), sizeof(trailer));
+        uint64_t footerSize = uint64_t(trailer.groupCount) * sizeof(LedgerRowGroup);
+        if (!file || memcmp(trailer.magic, LEDGER_MAGIC, sizeof(trailer.magic)) != 0 ||
+            (trailer.version != LEDGER_VERSION && trailer.version != 1) ||
+            trailer.footerOffset + footerSize + sizeof(trailer) != fileSize) {
+            cerr << "Ledger " << filename << " is not a valid ledger file.\n";
+            return false;
+        }
+        groups.resize(trailer.groupCount);
+        file.seekg(trailer.footerOffset);
+        file.read(reinterpret_cast<char*>(groups.data()), footerSize);
+        if (trailer.version == 1) {
+            for (LedgerRowGroup& group : groups) {
+                group.minCents = centsBound(group.minCents, false);
+                group.maxCents = centsBound(group.maxCents, true);
+            }
+        }
+        return bool(file);
+    }
+
+    uint32_t rowGroups() const { return groups.size(); }
+
+    // Calls handler(accNum, transaction) for every row with a timestamp in
+    // [from, to] and an amount in [minAmount, maxAmount]
+    template <typename Handler>
+    LedgerScanStats scan(time_t from, time_t to, Money minAmount, Money maxAmount, Handler handler) {
+        LedgerScanStats stats;
+        vector<char> data;
+        vector<string> accountValues, descriptionValues;
+        vector<uint32_t> accountIds, descriptionIds;
+        vector<Transaction> descriptionKinds; // parsed once per distinct text
+        vector<Transaction> rows;
+        for (const LedgerRowGroup& group : groups) {
+            if (group.maxTimestamp < from || group.minTimestamp > to ||
+                group.maxCents < minAmount.toCents() || group.minCents > maxAmount.toCents()) {
+                stats.groupsSkipped++;
+                continue;
+            }
+            uint64_t size = 0;
+            for (uint32_t bytes : group.columnBytes) {
+                size += bytes;
+            }
+            data.resize(size);
+            file.seekg(group.offset);
+            if (!file.read(data.data(), size) || crc32c(data.data(), size) != group.checksum ||
+                !decodeGroup(group, data, accountValues, accountIds, descriptionValues, descriptionIds, rows)) {
+                cerr << "Ledger row group at offset " << group.offset << " is corrupt.\n";
+                file.clear();
+                continue;
+            }
+            stats.groupsRead++;
+            stats.bytesRead += size;
+            descriptionKinds.resize(descriptionValues.size());
+            for (size_t i = 0; i < descriptionValues.size(); i++) {
+                parseTransactionText(descriptionValues[i], descriptionKinds[i]);
+            }
+            for (uint32_t i = 0; i < group.rows; i++) {
+                Transaction& t = rows[i];
+                if (t.timestamp < from || t.timestamp > to || t.amount < minAmount || t.amount > maxAmount) {
+                    continue;
+                }
+                t.kind = descriptionKinds[descriptionIds[i]].kind;
+                t.counterparty = descriptionKinds[descriptionIds[i]].counterparty;
+                handler(accountValues[accountIds[i]], t);
+                stats.rowsMatched++;
+            }
+        }
+        return stats;
+    }
+};
+
+class BankAccount;
+
+// Accounts changed since the last checkpoint. Each account adds itself
+// once, on the first change after it was last written out.
+class DirtyTracker {
+private:
+    mutex lock;
+    vector<BankAccount*> accounts;
+
+public:
+    void add(BankAccount* account) {
+        lock_guard<mutex> guard(lock);
+        accounts.push_back(account);
+    }
+
+    void remove(BankAccount* account) {
+        lock_guard<mutex> guard(lock);
+        accounts.erase(std::remove(accounts.begin(), accounts.end(), account), accounts.end());
+    }
+
+    vector<BankAccount*> take() {
+        lock_guard<mutex> guard(lock);
+        vector<BankAccount*> taken;
+        taken.swap(accounts);
+        return taken;
+    }
+};
+
+// Monthly interest earned on a balance, rounded to a cent
+Money monthlyInterest(Money balance, AccountType type) {
+    return balance.scale(type == SAVINGS ? SAVINGS_INTEREST_BP : CURRENT_INTEREST_BP, 10000 * 12,
+                         INTEREST_ROUNDING);
+}
+
+// Stores each distinct string once and names it by a 32-bit handle, for
+// values that many accounts share such as holder names. Strings are never
+// removed, so a handle stays valid for the life of the pool. Resolving a
+// handle takes no lock; interning locks one shard picked by hash, so the
+// threads materializing a snapshot rarely wait on each other.
+class InternPool {
+public:
+    typedef uint32_t Handle;
+
+private:
+    struct Shard {
+        mutex lock;
+        unordered_map<string_view, Handle> index; // views of the stored strings
+    };
+
+    Shard shards[INTERN_SHARDS];
+    unique_ptr<atomic<string*>[]> chunks;
+    mutex chunkLock; // taken only to add a chunk
+    atomic<uint32_t> next{0};
+
+    // Storage for a new handle, adding its chunk on first use
+    string& slot(Handle handle) {
+        atomic<string*>& chunk = chunks[handle / INTERN_CHUNK];
+        string* strings = chunk.load(memory_order_acquire);
+        if (!strings) {
+            lock_guard<mutex> guard(chunkLock);
+            strings = chunk.load(memory_order_relaxed);
+            if (!strings) {
+                strings = new string[INTERN_CHUNK];
+                chunk.store(strings, memory_order_release);
+            }
+        }
+        return strings[handle % INTERN_CHUNK];
+    }
+
+public:
+    InternPool() : chunks(new atomic<string*>[INTERN_MAX_CHUNKS]()) {}
+
+    InternPool(const InternPool&) = delete;
+    InternPool& operator=(const InternPool&) = delete;
+
+    ~InternPool() {
+        for (size_t i = 0; i < INTERN_MAX_CHUNKS; i++) {
+            delete[] chunks[i].load();
+        }
+    }
+
+    // Returns the handle of `text`, storing it if this is its first use.
+    // Safe to call from several threads.
+    Handle intern(string_view text) {
+        Shard& shard = shards[hash<string_view>()(text) % INTERN_SHARDS];
+        lock_guard<mutex> guard(shard.lock);
+        auto found = shard.index.find(text);
+        if (found != shard.index.end()) {
+            return found->second;
+        }
+        Handle handle = next.fetch_add(1);
+        if (handle >= INTERN_CHUNK * INTERN_MAX_CHUNKS) {
+            throw length_error("Intern pool is full");
+        }
+        string& stored = slot(handle);
+        stored.assign(text.data(), text.size());
+        shard.index.emplace(stored, handle);
+        return handle;
+    }
+
+    const string& get(Handle handle) const {
+        return chunks[handle / INTERN_CHUNK].load(memory_order_acquire)[handle % INTERN_CHUNK];
+    }
+
+    size_t size() const { return next; }
+
+    // Approximate heap use: chunk storage, text too long for a string's
+    // inline buffer, and the shards' hash nodes and buckets
+    size_t memoryBytes() {
+        size_t bytes = INTERN_MAX_CHUNKS * sizeof(atomic<string*>);
+        for (Shard& shard : shards) {
+            lock_guard<mutex> guard(shard.lock);
+            bytes += shard.index.bucket_count() * sizeof(void*) +
+                     shard.index.size() * (sizeof(void*) + sizeof(size_t) + sizeof(string_view) + sizeof(Handle));
+            for (const auto& entry : shard.index) {
+                bytes += entry.first.size() > 15 ? entry.first.size() + 1 : 0;
+            }
+        }
+        size_t count = next;
+        return bytes + (count + INTERN_CHUNK - 1) / INTERN_CHUNK * INTERN_CHUNK * sizeof(string);
+    }
+};
+
+// Holder names of every account in the process
+InternPool& holderNames() {
+    static InternPool pool;
+    return pool;
+}
+
+// Record of the transactions made in this process, numbered in the order
+// they were appended; the numbers are one global sequence for auditing
+// and replication. Each entry links to the previous entry of the same
+// account, so an account's history is a chain walked newest first from
+// the head it keeps. Appends are lock-free: a writer claims a number with
+// one atomic increment, fills its entry and then publishes it; chunks,
+// and the pages of chunk pointers that find them, are installed with a
+// compare-and-swap by whichever writer needs one first.
+//
+// Entries are never overwritten or moved. Memory is bounded by retiring
+// instead: once a checkpoint has made the history store durable,
+// retire() frees the whole chunks it covers, so only transactions the
+// store may not hold yet stay in memory. Without a store nothing is
+// retired and the journal keeps the whole session. Readers start at
+// firstKept(); chain walks end where retired entries begin, and the
+// store has everything before it.
+class TransactionJournal {
+public:
+    static const uint64_t NO_ENTRY = 0; // chain end; entries are numbered from 1
+
+private:
+    // Filled once by the writer that claimed it, then read only
+    struct Entry {
+        atomic<bool> published{false};
+        uint64_t accountId;
+        uint64_t previous;
+        Transaction t;
+    };
+
+    unique_ptr<atomic<atomic<Entry*>*>[]> pages; // JOURNAL_PAGES pages of JOURNAL_PAGE chunk pointers
+    atomic<uint64_t> next{1};
+    atomic<uint64_t> kept{1}; // entries before it are retired
+
+    // Readers hold it shared so retire() cannot free a chunk under them;
+    // appends never touch a retired chunk and do not take it
+    mutable shared_mutex retireLock;
+
+    template <typename T>
+    static T* install(atomic<T*>& pointer, size_t count, bool create) {
+        T* current = pointer.load(memory_order_acquire);
+        if (!current && create) {
+            T* fresh = new T[count]();
+            if (pointer.compare_exchange_strong(current, fresh, memory_order_acq_rel)) {
+                current = fresh;
+            } else {
+                delete[] fresh;
+            }
+        }
+        return current;
+    }
+
+    // The chunk holding entry `number`, installing it and its page if
+    // `create`; null if it is not installed yet
+    Entry* chunkOf(uint64_t number, bool create) const {
+        uint64_t chunk = (number - 1) / JOURNAL_CHUNK;
+        atomic<Entry*>* page = install(pages[chunk / JOURNAL_PAGE % JOURNAL_PAGES], JOURNAL_PAGE, create);
+        return page ? install(page[chunk % JOURNAL_PAGE], JOURNAL_CHUNK, create) : nullptr;
+    }
+
+    // Copies entry `number` out, waiting out a writer that has claimed it
+    // but not published it. The caller holds retireLock and has checked
+    // that the entry is not retired; false if its chunk is not installed.
+    bool read(uint64_t number, uint64_t& accountId, Transaction& t, uint64_t& previous) const {
+        Entry* entries = chunkOf(number, false);
+        if (!entries) {
+            return false;
+        }
+        const Entry& e = entries[(number - 1) % JOURNAL_CHUNK];
+        while (!e.published.load(memory_order_acquire)) {
+            this_thread::yield();
+        }
+        accountId = e.accountId;
+        previous = e.previous;
+        t = e.t;
+        return true;
+    }
+
+public:
+    TransactionJournal() : pages(new atomic<atomic<Entry*>*>[JOURNAL_PAGES]()) {}
+
+    TransactionJournal(const TransactionJournal&) = delete;
+    TransactionJournal& operator=(const TransactionJournal&) = delete;
+
+    ~TransactionJournal() {
+        for (size_t i = 0; i < JOURNAL_PAGES; i++) {
+            atomic<Entry*>* page = pages[i].load();
+            if (page) {
+                for (size_t j = 0; j < JOURNAL_PAGE; j++) {
+                    delete[] page[j].load();
+                }
+                delete[] page;
+            }
+        }
+    }
+
+    // Appends a transaction to the journal and to the chain whose newest
+    // entry is `head`, which is advanced to the new entry, and returns its
+    // number. Safe to call from several threads, including for the same
+    // account; appends that race on one account are chained in the order
+    // they swap the head, which need not be their order in the journal.
+    // Anything the caller did before the append, such as writing the
+    // transaction to the history store, is visible to whoever sees the
+    // number claimed.
+    uint64_t append(uint64_t accountId, const Transaction& t, atomic<uint64_t>& head) {
+        uint64_t number = next.fetch_add(1, memory_order_release);
+        Entry& e = chunkOf(number, true)[(number - 1) % JOURNAL_CHUNK];
+        e.accountId = accountId;
+        e.t = t;
+        e.previous = head.exchange(number, memory_order_acq_rel);
+        e.published.store(true, memory_order_release);
+        return number;
+    }
+
+    // Entries claimed so far, including retired ones; the last few may
+    // still be being written
+    uint64_t size() const { return next.load(memory_order_acquire) - 1; }
+
+    // Number of the oldest entry still held
+    uint64_t firstKept() const { return kept.load(memory_order_acquire); }
+
+    // Frees the chunks whose entries are all numbered `through` or less,
+    // which the caller has made durable in the history store. Waits for
+    // any of those entries still being written.
+    void retire(uint64_t through) {
+        unique_lock<shared_mutex> guard(retireLock);
+        uint64_t end = through / JOURNAL_CHUNK * JOURNAL_CHUNK + 1;
+        for (uint64_t first = kept.load(memory_order_relaxed); first < end; first += JOURNAL_CHUNK) {
+            Entry* entries;
+            while (!(entries = chunkOf(first, false))) {
+                this_thread::yield(); // claimed, but its writer has not installed it yet
+            }
+            for (size_t i = 0; i < JOURNAL_CHUNK; i++) {
+                while (!entries[i].published.load(memory_order_acquire)) {
+                    this_thread::yield();
+                }
+            }
+            uint64_t chunk = (first - 1) / JOURNAL_CHUNK;
+            atomic<atomic<Entry*>*>& page = pages[chunk / JOURNAL_PAGE % JOURNAL_PAGES];
+            delete[] page.load(memory_order_relaxed)[chunk % JOURNAL_PAGE].exchange(nullptr, memory_order_relaxed);
+            if (chunk % JOURNAL_PAGE == JOURNAL_PAGE - 1) {
+                delete[] page.exchange(nullptr, memory_order_relaxed);
+            }
+            kept.store(first + JOURNAL_CHUNK, memory_order_release);
+        }
+    }
+
+    // Calls handler(transaction) for up to `limit` entries of the chain
+    // ending at `head`, newest first, stopping where retired entries begin
+    template <typename Handler>
+    void forEachInChain(uint64_t head, size_t limit, Handler handler) const {
+        shared_lock<shared_mutex> guard(retireLock);
+        uint64_t accountId;
+        Transaction t;
+        for (uint64_t number = head; number >= firstKept() && limit > 0; limit--) {
+            if (!read(number, accountId, t, number)) {
+                return;
+            }
+            handler(t);
+        }
+    }
+
+    // Calls handler(accountId, transaction) for the entries still kept, in
+    // append order, up to those claimed when the call began; it stops at
+    // one whose chunk its writer has not installed yet
+    template <typename Handler>
+    void forEach(Handler handler) const {
+        shared_lock<shared_mutex> guard(retireLock);
+        uint64_t last = size();
+        uint64_t accountId, previous;
+        Transaction t;
+        for (uint64_t number = firstKept(); number <= last; number++) {
+            if (!read(number, accountId, t, previous)) {
+                return;
+            }
+            handler(accountId, t);
+        }
+    }
+
+    size_t memoryBytes() const {
+        shared_lock<shared_mutex> guard(retireLock);
+        size_t bytes = sizeof(*this) + JOURNAL_PAGES * sizeof(atomic<atomic<Entry*>*>);
+        for (size_t i = 0; i < JOURNAL_PAGES; i++) {
+            atomic<Entry*>* page = pages[i].load(memory_order_acquire);
+            if (page) {
+                bytes += JOURNAL_PAGE * sizeof(atomic<Entry*>);
+                for (size_t j = 0; j < JOURNAL_PAGE; j++) {
+                    bytes += page[j].load(memory_order_acquire) ? JOURNAL_CHUNK * sizeof(Entry) : 0;
+                }
+            }
+        }
+        return bytes;
+    }
+};
+
+// Fixed-capacity ring of an account's most recent transactions. Once
+// full, each push overwrites the oldest entry; with a history store
+// attached that entry was already written through to it.
+class TransactionRing {
+private:
+    Transaction entries[RECENT_TRANSACTIONS];
+    uint32_t head = 0;  // slot of the oldest entry
+    uint32_t count = 0;
+
+public:
+    size_t size() const { return count; }
+
+    // i = 0 is the oldest entry held
+    const Transaction& operator[](size_t i) const { return entries[(head + i) % RECENT_TRANSACTIONS]; }
+
+    void push(const Transaction& t) {
+        if (count < RECENT_TRANSACTIONS) {
+            entries[(head + count++) % RECENT_TRANSACTIONS] = t;
+        } else {
+            entries[head] = t;
+            head = (head + 1) % RECENT_TRANSACTIONS;
+        }
+    }
+};
+
+// Where an account's frequently swept fields live: a slot in each of the
+// dense parallel arrays kept by its AccountArena, so bank-wide passes
+// stream through balances and types without touching account objects
+struct AccountHotFields {
+    int64_t* balance; // cents
+    uint8_t* type;
+};
+
+// Bank Account
+class BankAccount {
+private:
+    uint64_t id;
+    InternPool::Handle holderName; // in holderNames()
+    string pin;
+    AccountHotFields hot; // balance and type
+    unique_ptr<TransactionRing> recent; // allocated by the first transaction
+    atomic<uint64_t> lastEntry{TransactionJournal::NO_ENTRY}; // newest of its entries in the journal
+    TransactionJournal* journal = nullptr;
+    TransactionLog* log = nullptr;
+    HistoryStore* history = nullptr;
+    DirtyTracker* tracker = nullptr;
+    atomic<bool> dirty{false};
+    uint32_t arenaSlot = 0; // set by the AccountArena that holds it
+    friend class AccountArena;
+
+    void remember(const Transaction& t) {
+        if (!recent) {
+            recent.reset(new TransactionRing());
+        }
+        recent->push(t);
+        if (journal) {
+            journal->append(id, t, lastEntry);
+        }
+    }
+
+public:
+    BankAccount(AccountHotFields hot, uint64_t id, InternPool::Handle name, string pin, AccountType type,
+                Money initial = Money())
+        : id(id), holderName(name), pin(pin), hot(hot) {
+        *hot.balance = initial.toCents();
+        *hot.type = type;
+    }
+
+    BankAccount(AccountHotFields hot, uint64_t id, string_view name, string pin, AccountType type,
+                Money initial = Money())
+        : BankAccount(hot, id, holderNames().intern(name), pin, type, initial) {}
+
+    uint64_t getId() const { return id; }
+    string getAccountNumber() const { return formatAccountNumber(id); }
+    const string& getHolderName() const { return holderNames().get(holderName); }
+    InternPool::Handle getHolderNameHandle() const { return holderName; }
+    string getPin() const { return pin; }
+    Money getBalance() const { return Money::fromCents(*hot.balance); }
+    AccountType getAccountType() const { return static_cast<AccountType>(*hot.type); }
+
+    // Up to `limit` of the transactions recorded in this process, oldest
+    // first: the last RECENT_TRANSACTIONS from the account's own ring,
+    // more from the journal while it still holds them. The history store,
+    // when attached, also has earlier ones.
+    vector<Transaction> getTransactions(size_t limit = SIZE_MAX) const {
+        vector<Transaction> list;
+        size_t held = recent ? recent->size() : 0;
+        if (journal && limit > held) {
+            journal->forEachInChain(lastEntry.load(memory_order_acquire), limit,
+                                    [&list](const Transaction& t) { list.push_back(t); });
+            reverse(list.begin(), list.end());
+        }
+        if (list.size() < min(limit, held)) {
+            list.clear();
+            for (size_t i = held > limit ? held - limit : 0; i < held; i++) {
+                list.push_back((*recent)[i]);
+            }
+        }
+        return list;
+    }
+
+    // Transactions are kept in the journal's recent view once one is attached
+    void setJournal(TransactionJournal* transactionJournal) { journal = transactionJournal; }
+
+    // Mutations are appended to the log once one is attached
+    void setLog(TransactionLog* transactionLog) { log = transactionLog; }
+
+    // Transactions are persisted to the history store once one is attached
+    void setHistory(HistoryStore* historyStore) { history = historyStore; }
+
+    void setDirtyTracker(DirtyTracker* dirtyTracker) { tracker = dirtyTracker; }
+
+    // Queues the account for the next checkpoint
+    void markDirty() {
+        if (tracker && !dirty.exchange(true)) {
+            tracker->add(this);
+        }
+    }
+
+    void clearDirty() { dirty = false; }
+    bool isDirty() const { return dirty; }
+
+    bool verifyPin(string inputPin) const {
+        return pin == inputPin;
+    }
+
+    void changePin(string newPin) {
+        if (log) {
+            log->logPinChange(getAccountNumber(), newPin);
+        }
+        pin = newPin;
+        markDirty();
+        recordTransaction(KIND_PIN_CHANGE, Money(), getBalance());
+    }
+
+    // `counterparty` is the other account of a transfer
+    void deposit(Money amount, TransactionKind kind = KIND_DEPOSIT, uint64_t counterparty = 0) {
+        if (amount <= Money()) {
+            throw invalid_argument("Amount must be positive");
+        }
+        recordTransaction(kind, amount, getBalance() + amount, counterparty);
+    }
+
+    bool withdraw(Money amount, TransactionKind kind = KIND_WITHDRAWAL, uint64_t counterparty = 0) {
+        if (amount <= Money()) {
+            throw invalid_argument("Amount must be positive");
+        }
+        if (getBalance() >= amount) {
+            recordTransaction(kind, -amount, getBalance() - amount, counterparty);
+            return true;
+        }
+        return false;
+    }
+
+    void addInterest() {
+        Money interest = monthlyInterest(getBalance(), getAccountType());
+        recordTransaction(KIND_INTEREST, interest, getBalance() + interest);
+    }
+
+    // Credits interest worked out by a bank-wide sweep
+    void recordInterest(Money interest) {
+        recordTransaction(KIND_INTEREST, interest, getBalance() + interest);
+    }
+
+    // Logs a transaction and then sets the balance to `newBalance`. If the
+    // log write throws, the account is left as it was.
+    void recordTransaction(TransactionKind kind, Money amount, Money newBalance, uint64_t counterparty = 0) {
+        Transaction t;
+        t.timestamp = time(nullptr);
+        t.amount = amount;
+        t.balanceAfter = newBalance;
+        t.kind = kind;
+        t.counterparty = counterparty;
+        
+        if (log) {
+            log->logTransaction(getId(), t);
+        }
+        *hot.balance = newBalance.toCents();
+        // Written to the store before the journal, so a checkpoint that
+        // syncs the store may retire every entry numbered before it began
+        if (history) {
+            history->append(getId(), t);
+        }
+        remember(t);
+        markDirty();
+    }
+
+    // Re-applies a transaction read back from the log during recovery.
+    // BankSystem::restoreHistory appends it to the history store if it
+    // had not reached it before the crash.
+    void restoreTransaction(const Transaction& t) {
+        *hot.balance = t.balanceAfter.toCents();
+        remember(t);
+        markDirty();
+    }
+
+    void restorePin(string newPin) {
+        pin = newPin;
+        markDirty();
+    }
+
+    void printStatement(int count = 5) const {
+        cout << "\nAccount Statement for " << getHolderName() << " (" << getAccountNumber() << ")\n";
+        cout << "Current Balance: $" << getBalance() << "\n\n";
+        cout << "Last " << count << " transactions:\n";
+        cout << "----------------------------------------------------------------------------\n";
+        cout << "Date/Time           | Description                | Amount    | Balance\n";
+        cout << "----------------------------------------------------------------------------\n";
+
+        // Transactions from before this process started come from the
+        // history store, which has every transaction including the ones
+        // still in memory
+        vector<Transaction> shown = getTransactions(count);
+        if (history && shown.size() < static_cast<size_t>(count)) {
+            shown = history->recent(id, count);
+        }
+
+        for (const Transaction& t : shown) {
+            cout << put_time(localtime(&t.timestamp), "%Y-%m-%d %H:%M:%S") << " | ";
+
+            // Text is only rendered here; records keep a kind and counterparty
+            char text[TRANSACTION_TEXT_MAX];
+            cout << setw(26) << left << string_view(text, describeTransaction(t, text)) << right;
+
+            cout << " | " << (t.amount < Money() ? "-" : (t.amount > Money() ? "+" : " ")) << "$" << setw(8)
+                 << (t.amount < Money() ? -t.amount : t.amount)
+                 << " | $" << setw(8) << t.balanceAfter << endl;
+        }
+        cout << "----------------------------------------------------------------------------\n";
+    }
+};
+
+const size_t ACCOUNT_SLAB_BYTES = 2 << 20; // one huge page per slab
+
+// Allocates BankAccounts from 2 MiB slabs so accounts sit together in
+// memory, iterate in slot order and are released a slab at a time.
+// Slots never move, so a slot index stays valid for the account's life;
+// slots of destroyed accounts go on a free list for reuse. Huge pages,
+// if requested, are a hint to the kernel (transparent huge pages on
+// Linux) and are silently ignored where unsupported.
+//
+// Each slab also keeps its accounts' hot fields (balance, type, flags)
+// in parallel arrays beside the objects, so bank-wide sweeps read a few
+// contiguous bytes per account instead of whole objects.
+class AccountArena {
+public:
+    static constexpr size_t SLOTS_PER_SLAB = ACCOUNT_SLAB_BYTES / sizeof(BankAccount);
+    static constexpr uint8_t SLOT_LIVE = 1; // flag: the slot holds an account
+
+    // One slab's slots, as handed to forEachSlab. Entries past `slots`
+    // were never handed out; flags tell which of the rest are live.
+    // Balances are in cents and are zero in every slot not live.
+    struct SlabView {
+        BankAccount* accounts;
+        int64_t* balances;
+        const uint8_t* types;
+        const uint8_t* flags;
+        size_t slots;
+    };
+
+private:
+    struct Slab {
+        char* accounts;
+        unique_ptr<int64_t[]> balances;
+        unique_ptr<uint8_t[]> types;
+        unique_ptr<uint8_t[]> flags;
+    };
+
+    mutex lock;
+    vector<Slab> slabs;
+    vector<uint32_t> freeSlots;  // destroyed slots, reused first
+    uint32_t used = 0;           // slots ever handed out
+    size_t count = 0;
+    bool hugePages;
+
+    Slab& slabOf(uint32_t slot) { return slabs[slot / SLOTS_PER_SLAB]; }
+
+    BankAccount* slotAddress(uint32_t slot) {
+        return reinterpret_cast<BankAccount*>(slabOf(slot).accounts) + slot % SLOTS_PER_SLAB;
+    }
+
+    // Returns a free slot, adding a slab when all are in use. Caller holds the lock.
+    uint32_t takeSlot() {
+        if (!freeSlots.empty()) {
+            uint32_t slot = freeSlots.back();
+            freeSlots.pop_back();
+            return slot;
+        }
+        if (used == slabs.size() * SLOTS_PER_SLAB) {
+            Slab slab;
+            slab.accounts = static_cast<char*>(::operator new(ACCOUNT_SLAB_BYTES, align_val_t(ACCOUNT_SLAB_BYTES)));
+#ifdef MADV_HUGEPAGE
+            if (hugePages) {
+                madvise(slab.accounts, ACCOUNT_SLAB_BYTES, MADV_HUGEPAGE);
+            }
+#endif
+            slab.balances.reset(new int64_t[SLOTS_PER_SLAB]());
+            slab.types.reset(new uint8_t[SLOTS_PER_SLAB]());
+            slab.flags.reset(new uint8_t[SLOTS_PER_SLAB]());
+            slabs.push_back(move(slab));
+        }
+        return used++;
+    }
+
+public:
+    explicit AccountArena(bool hugePages = false) : hugePages(hugePages) {}
+
+    AccountArena(const AccountArena&) = delete;
+    AccountArena& operator=(const AccountArena&) = delete;
+
+    ~AccountArena() {
+        forEach([](BankAccount* account) { account->~BankAccount(); });
+        for (Slab& slab : slabs) {
+            ::operator delete(slab.accounts, align_val_t(ACCOUNT_SLAB_BYTES));
+        }
+    }
+
+    // Constructs an account in a free slot, wired to that slot's hot
+    // fields. Safe to call from several threads.
+    template <typename... Args>
+    BankAccount* create(Args&&... args) {
+        uint32_t slot;
+        BankAccount* memory;
+        AccountHotFields hot;
+        {
+            lock_guard<mutex> guard(lock);
+            slot = takeSlot();
+            memory = slotAddress(slot);
+            Slab& slab = slabOf(slot);
+            hot.balance = &slab.balances[slot % SLOTS_PER_SLAB];
+            hot.type = &slab.types[slot % SLOTS_PER_SLAB];
+            slab.flags[slot % SLOTS_PER_SLAB] = SLOT_LIVE;
+            count++;
+        }
+        BankAccount* account;
+        try {
+            account = new (memory) BankAccount(hot, std::forward<Args>(args)...);
+        } catch (...) {
+            lock_guard<mutex> guard(lock);
+            slabOf(slot).flags[slot % SLOTS_PER_SLAB] = 0;
+            freeSlots.push_back(slot);
+            count--;
+            throw;
+        }
+        account->arenaSlot = slot;
+        return account;
+    }
+
+    // Destroys an account made by create and frees its slot for reuse.
+    // Accepts nullptr, like delete.
+    void destroy(BankAccount* account) {
+        if (!account) {
+            return;
+        }
+        uint32_t slot = account->arenaSlot;
+        account->~BankAccount();
+        lock_guard<mutex> guard(lock);
+        Slab& slab = slabOf(slot);
+        slab.flags[slot % SLOTS_PER_SLAB] = 0;
+        slab.balances[slot % SLOTS_PER_SLAB] = 0;
+        freeSlots.push_back(slot);
+        count--;
+    }
+
+    uint32_t slotOf(const BankAccount* account) const { return account->arenaSlot; }
+    size_t size() const { return count; }
+    size_t slabCount() const { return slabs.size(); }
+
+    // Visits live accounts in slot order. Must not run alongside create
+    // or destroy.
+    template <typename Handler>
+    void forEach(Handler handler) {
+        for (uint32_t slot = 0; slot < used; slot++) {
+            if (slabOf(slot).flags[slot % SLOTS_PER_SLAB] & SLOT_LIVE) {
+                handler(slotAddress(slot));
+            }
+        }
+    }
+
+    // Hands each slab's hot arrays to `handler` in turn, for sweeps that
+    // stream through balances and types. Same restriction as forEach.
+    template <typename Handler>
+    void forEachSlab(Handler handler) {
+        for (size_t i = 0; i < slabs.size(); i++) {
+            SlabView view;
+            view.accounts = reinterpret_cast<BankAccount*>(slabs[i].accounts);
+            view.balances = slabs[i].balances.get();
+            view.types = slabs[i].types.get();
+            view.flags = slabs[i].flags.get();
+            view.slots = min<size_t>(SLOTS_PER_SLAB, used - i * SLOTS_PER_SLAB);
+            handler(view);
+        }
+    }
+};
+
+// Credits a month's interest to every account in the arena. The interest
+// is worked out first by streaming through each slab's hot arrays, so a
+// balance that would overflow stops the run before any account changes;
+// each credit is then logged and applied through its account.
+void postMonthlyInterest(AccountArena& arena) {
+    vector<Money> interest;
+    interest.reserve(arena.slabCount() * AccountArena::SLOTS_PER_SLAB);
+    arena.forEachSlab([&interest](const AccountArena::SlabView& slab) {
+        for (size_t i = 0; i < slab.slots; i++) {
+            Money balance = Money::fromCents(slab.balances[i]);
+            Money earned = monthlyInterest(balance, static_cast<AccountType>(slab.types[i]));
+            if (!balance.canAdd(earned)) {
+                throw overflow_error("Interest would take a balance out of range");
+            }
+            interest.push_back(earned);
+        }
+    });
+    size_t next = 0;
+    arena.forEachSlab([&interest, &next](const AccountArena::SlabView& slab) {
+        for (size_t i = 0; i < slab.slots; i++, next++) {
+            if (slab.flags[i] & AccountArena::SLOT_LIVE) {
+                slab.accounts[i].recordInterest(interest[next]);
+            }
+        }
+    });
+}
+
+// Bank-wide figures gathered by one sweep over the hot account fields
+struct BankTotals {
+    size_t savings = 0;
+    size_t current = 0;
+    Money balance;
+};
+
+// Sum of a run of balances in cents. Integer addition is associative, so
+// the total is exact in any order: the four running sums below let -O2
+// use vector adds (a double sum has to stay in order), and -O3 widens
+// them further. Each balance is split into its high and low 32 bits,
+// summed apart, so no running sum can overflow for runs of fewer than
+// 2^31 balances; the halves are put back together with Money's checked
+// arithmetic, which throws if the total is out of range. Slots not live
+// hold zero and need no test.
+Money sumBalances(const int64_t* cents, size_t count) {
+    int64_t high[4] = {0, 0, 0, 0};
+    int64_t low[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (size_t lane = 0; lane < 4; lane++) {
+            high[lane] += cents[i + lane] >> 32;
+            low[lane] += cents[i + lane] & 0xffffffff;
+        }
+    }
+    for (; i < count; i++) {
+        high[0] += cents[i] >> 32;
+        low[0] += cents[i] & 0xffffffff;
+    }
+    // Carrying the low sum's upper bits over leaves the high part a
+    // multiple of 2^32 no lower than any total in range
+    int64_t lowSum = low[0] + low[1] + low[2] + low[3];
+    Money highSum = Money::fromCents(high[0] + high[1] + high[2] + high[3] + (lowSum >> 32));
+    return highSum.scale(int64_t(1) << 32, 1, ROUND_DOWN) + Money::fromCents(lowSum & 0xffffffff);
+}
+
+BankTotals sumAccounts(AccountArena& arena) {
+    BankTotals totals;
+    arena.forEachSlab([&totals](const AccountArena::SlabView& slab) {
+        totals.balance += sumBalances(slab.balances, slab.slots);
+        size_t live = 0, savings = 0;
+        for (size_t i = 0; i < slab.slots; i++) {
+            bool isLive = slab.flags[i] & AccountArena::SLOT_LIVE;
+            live += isLive;
+            savings += isLive && slab.types[i] == SAVINGS;
+        }
+        totals.savings += savings;
+        totals.current += live - savings;
+    });
+    return totals;
+}
+
+// Snapshot file layout (little-endian):
+//   SnapshotHeader
+//   accountCount x SnapshotRecord, sorted by account number
+//   string table: each entry is a uint32 length followed by the bytes;
+//     from version 6 it opens with each distinct holder name once,
+//     followed by every record's number and PIN
+//   directory + SnapshotTrailer (version 3 and later)
+//   block checksums + SnapshotChecksumTrailer (version 4 and later)
+// Records refer to their strings by byte offset into the string table.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t accountCount;
+    uint64_t stringTableSize;
+    uint64_t checkpointId; // full snapshot id, or delta sequence number
+    uint64_t baseId;       // 0 for a full snapshot, else the full snapshot a delta applies to
+};
+
+struct SnapshotRecord {
+    uint64_t numberRef;
+    uint64_t nameRef;
+    uint64_t pinRef;
+    uint32_t type;
+    uint32_t reserved;
+    int64_t balance; // cents; a double in versions before 5, see snapshotBalance
+};
+
+// A record's balance, read according to the version of its file
+Money snapshotBalance(const SnapshotRecord& record, uint32_t version) {
+    if (version >= 5) {
+        return Money::fromCents(record.balance);
+    }
+    double balance;
+    memcpy(&balance, &record.balance, sizeof(balance));
+    return Money::fromDouble(balance);
+}
+
+// Version 3 snapshots end with a directory of record blocks and this
+// fixed-size trailer. Each directory entry covers SNAPSHOT_INDEX_BLOCK
+// consecutive records: the first record's index, where the block's
+// strings start in the string table and how many bytes they take, and
+// the block's smallest and largest account numbers.
+struct SnapshotTrailer {
+    uint64_t directoryOffset;
+    uint64_t directorySize;
+    uint32_t blockRecords;
+    uint32_t blockCount;
+    char magic[8];
+};
+
+// Version 4 snapshots follow the directory trailer with one CRC-32C per
+// SNAPSHOT_CHECKSUM_BLOCK bytes of everything before them, then this
+// trailer.
+struct SnapshotChecksumTrailer {
+    uint64_t coveredBytes;
+    uint32_t blockSize;
+    uint32_t blockCount;
+    char magic[8];
+};
+
+struct SnapshotBlock {
+    uint64_t firstRecord;
+    uint64_t recordCount;
+    uint64_t stringOffset;
+    uint64_t stringBytes;
+    string minKey;
+    string maxKey;
+};
+
+// Reads a length-prefixed string out of a snapshot string table
+bool readSnapshotString(const char* table, uint64_t tableSize, uint64_t ref, string& out) {
+    uint32_t length;
+    if (ref > tableSize || tableSize - ref < sizeof(length)) {
+        return false;
+    }
+    memcpy(&length, table + ref, sizeof(length));
+    if (tableSize - ref - sizeof(length) < length) {
+        return false;
+    }
+    out.assign(table + ref + sizeof(length), length);
+    return true;
+}
+
+// Finds the checksum section of a version 4 snapshot held in memory.
+// Returns false, with the reason on cerr, if it is missing or damaged.
+bool locateSnapshotChecksums(const char* base, uint64_t fileSize, const string& filename,
+                             SnapshotChecksumTrailer& trailer, const char*& sums) {
+    memcpy(&trailer, base + fileSize - sizeof(trailer), sizeof(trailer));
+    uint64_t tableSize = uint64_t(trailer.blockCount) * sizeof(uint32_t);
+    if (memcmp(trailer.magic, SNAPSHOT_CHECKSUM_MAGIC, sizeof(trailer.magic)) != 0 ||
+        trailer.blockSize == 0 || trailer.coveredBytes > fileSize - sizeof(trailer) ||
+        fileSize - sizeof(trailer) - trailer.coveredBytes != tableSize ||
+        trailer.blockCount != (trailer.coveredBytes + trailer.blockSize - 1) / trailer.blockSize) {
+        cerr << "Snapshot " << filename << " has a corrupt checksum table.\n";
+        return false;
+    }
+    sums = base + trailer.coveredBytes;
+    return true;
+}
+
+// Checks every block against the checksum table, using all cores.
+// Returns the index of the first damaged block, or -1 if all match.
+int64_t verifySnapshotChecksums(const char* base, const SnapshotChecksumTrailer& trailer, const char* sums) {
+    vector<uint32_t> actual = crc32cBlocks(base, trailer.coveredBytes, trailer.blockSize);
+    for (size_t block = 0; block < actual.size(); block++) {
+        uint32_t expected;
+        memcpy(&expected, sums + block * sizeof(expected), sizeof(expected));
+        if (actual[block] != expected) {
+            return block;
+        }
+    }
+    return -1;
+}
+
+// Appends the checksum section to a snapshot image
+void appendSnapshotChecksums(vector<char>& image) {
+    SnapshotChecksumTrailer trailer = {};
+    trailer.coveredBytes = image.size();
+    trailer.blockSize = SNAPSHOT_CHECKSUM_BLOCK;
+    vector<uint32_t> sums = crc32cBlocks(image.data(), image.size(), SNAPSHOT_CHECKSUM_BLOCK);
+    trailer.blockCount = sums.size();
+    memcpy(trailer.magic, SNAPSHOT_CHECKSUM_MAGIC, sizeof(trailer.magic));
+    for (uint32_t sum : sums) {
+        putValue(image, sum);
+    }
+    putValue(image, trailer);
+}
+
+// Quotes a CSV field if it contains a comma or quote
+string csvQuote(const string& field) {
+    if (field.find_first_of(",\"") == string::npos) {
+        return field;
+    }
+    string quoted = "\"";
+    for (char c : field) {
+        quoted += c;
+        if (c == '"') {
+            quoted += '"';
+        }
+    }
+    return quoted + "\"";
+}
+
+// Outcome of the most recent checkpoint
+struct CheckpointStats {
+    bool completed = false;
+    bool succeeded = false;
+    bool full = false;
+    size_t accounts = 0;
+    double captureMillis = 0; // time the caller was blocked
+    double writeMillis = 0;   // background serialization, write and fsync
+};
+
+// What a snapshot record holds of an account, copied out of it at the
+// moment a checkpoint is taken
+struct AccountImage {
+    uint64_t id;
+    InternPool::Handle name;
+    uint8_t type;
+    int64_t cents;
+    string pin;
+};
+
+// Checks a snapshot header against the size of the file it came from
+bool validateSnapshotHeader(const SnapshotHeader& header, uint64_t fileSize, const string& filename) {
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        cerr << filename << " is not a bank snapshot.\n";
+        return false;
+    }
+    if (header.version < SNAPSHOT_MIN_VERSION || header.version > SNAPSHOT_VERSION ||
+        header.recordSize != sizeof(SnapshotRecord)) {
+        cerr << "Unsupported snapshot version " << header.version << ".\n";
+        return false;
+    }
+
+    // Version 2 files end with the string table; later ones carry the
+    // footer directory after it
+    uint64_t payload = fileSize - sizeof(header);
+    bool fits = header.accountCount <= payload / sizeof(SnapshotRecord) &&
+                payload - header.accountCount * sizeof(SnapshotRecord) >= header.stringTableSize;
+    uint64_t footer = fits ? payload - header.accountCount * sizeof(SnapshotRecord) - header.stringTableSize : 0;
+    uint64_t minimumFooter = 0;
+    if (header.version >= 3) {
+        minimumFooter += sizeof(SnapshotTrailer);
+    }
+    if (header.version >= 4) {
+        minimumFooter += sizeof(SnapshotChecksumTrailer);
+    }
+    if (!fits || footer < minimumFooter || (header.version == 2 && footer != 0)) {
+        cerr << "Snapshot " << filename << " is truncated.\n";
+        return false;
+    }
+    return true;
+}
+
+// Read-only view of a snapshot file mapped into memory. Records and
+// strings are used in place, so opening costs one mmap regardless of
+// account count and pages are faulted in only as records are touched.
+// Checksummed blocks are likewise verified the first time a record in
+// them is materialized.
+class MappedSnapshot {
+private:
+    enum BlockState : uint8_t { BLOCK_UNCHECKED, BLOCK_GOOD, BLOCK_DAMAGED };
+
+    const char* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    vector<char> contents;
+#endif
+    SnapshotHeader header = {};
+    const char* records = nullptr;
+    const char* table = nullptr;
+    SnapshotChecksumTrailer checksums = {};
+    const char* sums = nullptr;
+    unique_ptr<atomic<uint8_t>[]> blockStates;
+
+    // True if every checksum block overlapping the byte range is intact
+    bool verifyRange(const char* start, uint64_t size) const {
+        if (!sums) {
+            return true;
+        }
+        uint64_t offset = start - base;
+        uint64_t last = min(offset + max<uint64_t>(size, 1), checksums.coveredBytes);
+        for (uint64_t block = offset / checksums.blockSize; block * checksums.blockSize < last; block++) {
+            uint8_t state = blockStates[block].load(memory_order_acquire);
+            if (state == BLOCK_UNCHECKED) {
+                uint64_t blockStart = block * checksums.blockSize;
+                uint64_t blockSize = min<uint64_t>(checksums.blockSize, checksums.coveredBytes - blockStart);
+                uint32_t expected;
+                memcpy(&expected, sums + block * sizeof(expected), sizeof(expected));
+                state = crc32c(base + blockStart, blockSize) == expected ? BLOCK_GOOD : BLOCK_DAMAGED;
+                blockStates[block].store(state, memory_order_release);
+            }
+            if (state == BLOCK_DAMAGED) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    SnapshotRecord recordAt(uint64_t index) const {
+        SnapshotRecord record;
+        memcpy(&record, records + index * sizeof(SnapshotRecord), sizeof(record));
+        return record;
+    }
+
+    // Account number of a record, without copying it out of the mapping
+    string_view numberAt(uint64_t index) const {
+        uint64_t ref = recordAt(index).numberRef;
+        uint32_t size;
+        if (ref > header.stringTableSize || header.stringTableSize - ref < sizeof(size)) {
+            return string_view();
+        }
+        memcpy(&size, table + ref, sizeof(size));
+        if (header.stringTableSize - ref - sizeof(size) < size) {
+            return string_view();
+        }
+        return string_view(table + ref + sizeof(size), size);
+    }
+
+public:
+    MappedSnapshot() = default;
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+    ~MappedSnapshot() {
+#ifndef _WIN32
+        if (base) {
+            munmap(const_cast<char*>(base), length);
+        }
+#endif
+    }
+
+    bool open(string filename) {
+#ifdef _WIN32
+        ifstream file(filename, ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        contents.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        base = contents.data();
+        length = contents.size();
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(SnapshotHeader))) {
+            ::close(fd);
+            cerr << "Snapshot " << filename << " is truncated.\n";
+            return false;
+        }
+        length = info.st_size;
+        void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            cerr << "Error mapping snapshot " << filename << ".\n";
+            return false;
+        }
+        base = static_cast<const char*>(mapping);
+#endif
+        if (length < sizeof(SnapshotHeader)) {
+            return false;
+        }
+        memcpy(&header, base, sizeof(header));
+        if (!validateSnapshotHeader(header, length, filename)) {
+            return false;
+        }
+        records = base + sizeof(header);
+        table = records + header.accountCount * sizeof(SnapshotRecord);
+        if (header.version >= 4) {
+            if (!locateSnapshotChecksums(base, length, filename, checksums, sums)) {
+                return false;
+            }
+            blockStates.reset(new atomic<uint8_t>[checksums.blockCount]());
+        }
+        return true;
+    }
+
+    const SnapshotHeader& getHeader() const { return header; }
+    uint64_t size() const { return header.accountCount; }
+
+    // Binary search over the sorted records; returns size() if absent
+    uint64_t find(const string& accNum) const {
+        uint64_t low = 0, high = header.accountCount;
+        while (low < high) {
+            uint64_t mid = low + (high - low) / 2;
+            if (numberAt(mid) < accNum) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        if (low < header.accountCount && numberAt(low) == accNum) {
+            return low;
+        }
+        return header.accountCount;
+    }
+
+    // Builds the BankAccount for a record in `arena`, or returns nullptr
+    // if corrupt
+    BankAccount* materialize(uint64_t index, AccountArena& arena) const {
+        if (!verifyRange(records + index * sizeof(SnapshotRecord), sizeof(SnapshotRecord))) {
+            cerr << "Snapshot record " << index << " failed its checksum.\n";
+            return nullptr;
+        }
+        SnapshotRecord record = recordAt(index);
+        string accNum, name, pin;
+        uint64_t id;
+        if (!readSnapshotString(table, header.stringTableSize, record.numberRef, accNum) ||
+            !readSnapshotString(table, header.stringTableSize, record.nameRef, name) ||
+            !readSnapshotString(table, header.stringTableSize, record.pinRef, pin) ||
+            record.type > CURRENT || !parseAccountNumber(accNum, id)) {
+            cerr << "Snapshot has a corrupt record at index " << index << ".\n";
+            return nullptr;
+        }
+        // A record's number and PIN are consecutive in the table, with the
+        // name between them before version 6 and in a shared run after
+        if (!verifyRange(table + record.numberRef,
+                         record.pinRef + sizeof(uint32_t) + pin.size() - record.numberRef) ||
+            !verifyRange(table + record.nameRef, sizeof(uint32_t) + name.size())) {
+            cerr << "Snapshot record " << index << " failed its checksum.\n";
+            return nullptr;
+        }
+        return arena.create(id, name, pin, static_cast<AccountType>(record.type),
+                            snapshotBalance(record, header.version));
+    }
+};
+
+const uint64_t WARMER_CHUNK_SLOTS = 4096; // warmer slots allocated together
+const uint64_t WARMER_BATCH = 256;        // accounts the warmer builds between yields
+
+// Materializes a mapped snapshot's accounts on a background thread so
+// that later lookups find them ready. Every record has a slot: the
+// warmer fills empty slots and a lookup claims a slot, taking whatever
+// account is there. Whichever of the two comes second backs off, so a
+// lookup never waits for the warmer.
+class SnapshotWarmer {
+private:
+    const MappedSnapshot& snapshot;
+    AccountArena& arena;
+    typedef atomic<BankAccount*> Slot;
+    unique_ptr<atomic<Slot*>[]> chunks; // allocated on first use
+    uint64_t chunkCount;
+    atomic<bool> stopping{false};
+    atomic<uint64_t> warmed{0};
+    thread worker;
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    atomic<double> seconds{0};
+
+    // Marks a slot whose record was claimed; never dereferenced
+    static BankAccount* claimedMarker() {
+        static char marker;
+        return reinterpret_cast<BankAccount*>(&marker);
+    }
+
+    Slot& slot(uint64_t index) {
+        atomic<Slot*>& chunk = chunks[index / WARMER_CHUNK_SLOTS];
+        Slot* slots = chunk.load();
+        if (!slots) {
+            Slot* fresh = new Slot[WARMER_CHUNK_SLOTS]();
+            if (chunk.compare_exchange_strong(slots, fresh)) {
+                slots = fresh;
+            } else {
+                delete[] fresh;
+            }
+        }
+        return slots[index % WARMER_CHUNK_SLOTS];
+    }
+
+    void run() {
+        for (uint64_t i = 0; i < snapshot.size() && !stopping; i++) {
+            if (i % WARMER_BATCH == 0) {
+                this_thread::yield(); // let foreground requests go first
+            }
+            Slot& target = slot(i);
+            if (target.load(memory_order_relaxed) != nullptr) {
+                continue;
+            }
+            BankAccount* account = snapshot.materialize(i, arena);
+            BankAccount* expected = nullptr;
+            if (account && !target.compare_exchange_strong(expected, account)) {
+                arena.destroy(account); // claimed meanwhile
+            }
+            warmed.fetch_add(1, memory_order_relaxed);
+        }
+        seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    }
+
+public:
+    // Slots are allocated a chunk at a time as the warmer or a lookup
+    // reaches them, so starting the warmer costs next to nothing for any
+    // size of bank
+    SnapshotWarmer(const MappedSnapshot& snapshot, AccountArena& arena)
+        : snapshot(snapshot), arena(arena),
+          chunkCount((snapshot.size() + WARMER_CHUNK_SLOTS - 1) / WARMER_CHUNK_SLOTS) {
+        chunks.reset(new atomic<Slot*>[chunkCount]());
+        worker = thread(&SnapshotWarmer::run, this);
+    }
+
+    ~SnapshotWarmer() {
+        stop();
+        for (uint64_t c = 0; c < chunkCount; c++) {
+            Slot* slots = chunks[c].load();
+            if (!slots) {
+                continue;
+            }
+            for (uint64_t i = 0; i < WARMER_CHUNK_SLOTS; i++) {
+                BankAccount* account = slots[i].load();
+                if (account != claimedMarker()) {
+                    arena.destroy(account);
+                }
+            }
+            delete[] slots;
+        }
+    }
+
+    void stop() {
+        stopping = true;
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    // Takes the warmed account for a record, or returns nullptr if the
+    // warmer has not reached it (the caller materializes it instead).
+    // Each record can be claimed once.
+    BankAccount* claim(uint64_t index) {
+        BankAccount* account = slot(index).exchange(claimedMarker());
+        return account == claimedMarker() ? nullptr : account;
+    }
+
+    uint64_t progress() const { return warmed; }
+    bool finished() const { return seconds > 0 || warmed == snapshot.size(); }
+    double elapsedSeconds() const { return seconds; }
+};
+
+// Reads single accounts out of a snapshot through its footer directory.
+// Opening reads only the header and the directory; a lookup then reads
+// the string run of the one block that can hold the account and that
+// account's record, without loading or mapping the rest of the file.
+class SnapshotIndex {
+private:
+    ifstream file;
+    SnapshotHeader header = {};
+    vector<SnapshotBlock> blocks;
+    uint64_t bytesRead = 0;
+
+    bool readAt(uint64_t offset, char* out, size_t size) {
+        file.seekg(offset);
+        if (!file.read(out, size)) {
+            file.clear();
+            return false;
+        }
+        bytesRead += size;
+        return true;
+    }
+
+    // Reads a name out of the shared pool that starts the string table
+    bool readPooledName(uint64_t tableStart, uint64_t ref, string& name) {
+        uint32_t size;
+        if (ref > header.stringTableSize || header.stringTableSize - ref < sizeof(size) ||
+            !readAt(tableStart + ref, reinterpret_cast<char*>(&size), sizeof(size)) ||
+            header.stringTableSize - ref - sizeof(size) < size) {
+            return false;
+        }
+        name.resize(size);
+        return readAt(tableStart + ref + sizeof(size), &name[0], size);
+    }
+
+public:
+    bool open(string filename) {
+        file.close();
+        file.clear();
+        blocks.clear();
+        bytesRead = 0;
+        file.open(filename, ios::binary | ios::ate);
+        if (!file.is_open()) {
+            return false;
+        }
+        uint64_t fileSize = file.tellg();
+        if (fileSize < sizeof(header) || !readAt(0, reinterpret_cast<char*>(&header), sizeof(header)) ||
+            !validateSnapshotHeader(header, fileSize, filename)) {
+            return false;
+        }
+        if (header.version < 3) {
+            cerr << "Snapshot " << filename << " has no account index; rewrite it with a checkpoint.\n";
+            return false;
+        }
+
+        // Version 4 puts the checksum section after the directory trailer
+        uint64_t indexEnd = fileSize;
+        if (header.version >= 4) {
+            SnapshotChecksumTrailer checksums;
+            if (!readAt(fileSize - sizeof(checksums), reinterpret_cast<char*>(&checksums), sizeof(checksums)) ||
+                memcmp(checksums.magic, SNAPSHOT_CHECKSUM_MAGIC, sizeof(checksums.magic)) != 0 ||
+                checksums.coveredBytes > fileSize - sizeof(checksums)) {
+                cerr << "Snapshot " << filename << " has a corrupt checksum table.\n";
+                return false;
+            }
+            indexEnd = checksums.coveredBytes;
+        }
+
+        SnapshotTrailer trailer;
+        uint64_t tableEnd = sizeof(header) + header.accountCount * sizeof(SnapshotRecord) + header.stringTableSize;
+        if (indexEnd < tableEnd + sizeof(trailer) ||
+            !readAt(indexEnd - sizeof(trailer), reinterpret_cast<char*>(&trailer), sizeof(trailer)) ||
+            memcmp(trailer.magic, SNAPSHOT_INDEX_MAGIC, sizeof(trailer.magic)) != 0 ||
+            trailer.directoryOffset != tableEnd ||
+            trailer.directorySize != indexEnd - sizeof(trailer) - tableEnd) {
+            cerr << "Snapshot " << filename << " has a corrupt account index.\n";
+            return false;
+        }
+        vector<char> directory(trailer.directorySize);
+        if (!readAt(trailer.directoryOffset, directory.data(), directory.size())) {
+            return false;
+        }
+        ByteReader reader(directory.data(), directory.size());
+        blocks.resize(trailer.blockCount);
+        for (SnapshotBlock& block : blocks) {
+            if (!reader.get(block.firstRecord) || !reader.get(block.recordCount) ||
+                !reader.get(block.stringOffset) || !reader.get(block.stringBytes) ||
+                !reader.getString(block.minKey) || !reader.getString(block.maxKey) ||
+                block.firstRecord + block.recordCount > header.accountCount ||
+                block.stringOffset + block.stringBytes > header.stringTableSize) {
+                cerr << "Snapshot " << filename << " has a corrupt account index.\n";
+                blocks.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const SnapshotHeader& getHeader() const { return header; }
+    uint64_t getBytesRead() const { return bytesRead; }
+
+    // Finds one account; returns false if it is not in this snapshot
+    bool lookup(const string& accNum, SnapshotRecord& record, string& name, string& pin) {
+        auto block = lower_bound(blocks.begin(), blocks.end(), accNum,
+                                 [](const SnapshotBlock& b, const string& key) { return b.maxKey < key; });
+        if (block == blocks.end() || accNum < block->minKey) {
+            return false;
+        }
+
+        // Each record owns consecutive strings in the block's run: number,
+        // name, PIN, or from version 6 just number and PIN, the name
+        // living in the shared pool at the start of the table
+        bool sharedNames = header.version >= 6;
+        uint64_t tableStart = sizeof(header) + header.accountCount * sizeof(SnapshotRecord);
+        vector<char> run(block->stringBytes);
+        if (!readAt(tableStart + block->stringOffset, run.data(), run.size())) {
+            return false;
+        }
+        uint64_t ref = 0;
+        string number;
+        for (uint64_t i = 0; i < block->recordCount; i++) {
+            uint64_t numberRef = ref;
+            if (!readSnapshotString(run.data(), run.size(), ref, number)) {
+                return false;
+            }
+            ref += sizeof(uint32_t) + number.size();
+            if (!sharedNames) {
+                if (!readSnapshotString(run.data(), run.size(), ref, name)) {
+                    return false;
+                }
+                ref += sizeof(uint32_t) + name.size();
+            }
+            if (!readSnapshotString(run.data(), run.size(), ref, pin)) {
+                return false;
+            }
+            ref += sizeof(uint32_t) + pin.size();
+            if (number != accNum) {
+                continue;
+            }
+            uint64_t index = block->firstRecord + i;
+            if (!readAt(sizeof(header) + index * sizeof(SnapshotRecord),
+                        reinterpret_cast<char*>(&record), sizeof(record)) ||
+                record.numberRef != block->stringOffset + numberRef || record.type > CURRENT) {
+                return false;
+            }
+            return !sharedNames || readPooledName(tableStart, record.nameRef, name);
+        }
+        return false;
+    }
+};
+
+// In-memory account index: open addressing with linear probing over a
+// flat power-of-two slot array, keyed by the numeric account id. Id 0 is
+// never issued and marks an empty slot. Iteration order is unspecified;
+// callers that need account-number order sort what they collect.
+class AccountIndex {
+public:
+    struct Slot {
+        uint64_t id;
+        BankAccount* account;
+    };
+
+private:
+    vector<Slot> slots;
+    size_t mask = 0;
+    size_t count = 0;
+
+    size_t home(uint64_t id) const {
+        // Fibonacci hashing spreads sequential ids across the table
+        return static_cast<size_t>((id * 0x9E3779B97F4A7C15ULL) >> 20) & mask;
+    }
+
+    void grow() {
+        vector<Slot> old;
+        old.swap(slots);
+        slots.assign(old.empty() ? 16 : old.size() * 2, Slot{0, nullptr});
+        mask = slots.size() - 1;
+        for (const Slot& slot : old) {
+            if (slot.id != 0) {
+                size_t i = home(slot.id);
+                while (slots[i].id != 0) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = slot;
+            }
+        }
+    }
+
+public:
+    size_t size() const { return count; }
+
+    // Sizes the table for `expected` accounts up front
+    void reserve(size_t expected) {
+        while (slots.size() * 3 < expected * 4) {
+            grow();
+        }
+    }
+
+    BankAccount* find(uint64_t id) const {
+        if (count == 0) {
+            return nullptr;
+        }
+        for (size_t i = home(id); slots[i].id != 0; i = (i + 1) & mask) {
+            if (slots[i].id == id) {
+                return slots[i].account;
+            }
+        }
+        return nullptr;
+    }
+
+    // Adds or replaces the account stored under `id`. Returns the account
+    // it replaced, or nullptr if the id was new.
+    BankAccount* put(uint64_t id, BankAccount* account) {
+        if ((count + 1) * 4 > slots.size() * 3) {
+            grow();
+        }
+        size_t i = home(id);
+        for (; slots[i].id != 0; i = (i + 1) & mask) {
+            if (slots[i].id == id) {
+                BankAccount* previous = slots[i].account;
+                slots[i].account = account;
+                return previous;
+            }
+        }
+        slots[i] = Slot{id, account};
+        count++;
+        return nullptr;
+    }
+
+    // Removes `id`, shifting later entries of its probe run back so no
+    // tombstones are needed. Returns the removed account, if any.
+    BankAccount* erase(uint64_t id) {
+        if (count == 0) {
+            return nullptr;
+        }
+        size_t i = home(id);
+        while (slots[i].id != id) {
+            if (slots[i].id == 0) {
+                return nullptr;
+            }
+            i = (i + 1) & mask;
+        }
+        BankAccount* removed = slots[i].account;
+        size_t hole = i;
+        for (size_t j = (i + 1) & mask; slots[j].id != 0; j = (j + 1) & mask) {
+            // An entry may fill the hole only if its home is not in (hole, j]
+            size_t distance = (j - home(slots[j].id)) & mask;
+            if (distance >= ((j - hole) & mask)) {
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole] = Slot{0, nullptr};
+        count--;
+        return removed;
+    }
+
+    template <typename Handler>
+    void forEach(Handler handler) const {
+        for (const Slot& slot : slots) {
+            if (slot.id != 0) {
+                handler(slot.account);
+            }
+        }
+    }
+
+    // Accounts ordered by account number string, as snapshots and the
+    // admin listing expect
+    vector<BankAccount*> sorted() const {
+        vector<BankAccount*> list;
+        list.reserve(count);
+        forEach([&list](BankAccount* account) { list.push_back(account); });
+        sort(list.begin(), list.end(), [](const BankAccount* a, const BankAccount* b) {
+            return accountNumberLess(a->getId(), b->getId());
+        });
+        return list;
+    }
+};
+
+// Issues account ids to concurrent callers. Sequence numbers are reserved
+// from a small state file a block at a time, so ids stay unique across
+// restarts without a write per account; a crash only skips the unused
+// rest of a block. Without a state file the generator works in memory.
+class AccountIdGenerator {
+private:
+    mutex lock;
+    string path;
+    uint64_t next = FIRST_ACCOUNT_SEQUENCE;     // next sequence to hand out
+    uint64_t reserved = FIRST_ACCOUNT_SEQUENCE; // sequences below this are recorded on disk
+
+    // Records that sequences below `limit` may be in use
+    bool persist(uint64_t limit) {
+        string tempFile = path + ".tmp";
+        string text = "next " + to_string(limit) + "\n";
+        if (!writeFileDurably(tempFile, vector<char>(text.begin(), text.end()))) {
+            return false;
+        }
+        if (!replaceFileAtomically(tempFile, path)) {
+            cerr << "Error replacing " << path << ".\n";
+            return false;
+        }
+        return true;
+    }
+
+public:
+    // Resumes from the state file, creating it if missing
+    bool open(string filename) {
+        lock_guard<mutex> guard(lock);
+        path = filename;
+        ifstream in(filename);
+        string key;
+        uint64_t saved;
+        if (in >> key >> saved && key == "next" && saved > next) {
+            next = saved;
+        }
+        reserved = next;
+        return persist(reserved);
+    }
+
+    // Issues the next id. Throws if the block it comes from cannot be
+    // recorded, since after a restart the id could be handed out again.
+    uint64_t nextId() {
+        lock_guard<mutex> guard(lock);
+        if (!path.empty() && next >= reserved) {
+            if (!persist(next + ACCOUNT_SEQUENCE_BLOCK)) {
+                throw runtime_error("cannot reserve account numbers in " + path);
+            }
+            reserved = next + ACCOUNT_SEQUENCE_BLOCK;
+        }
+        return makeAccountId(next++);
+    }
+
+    // Moves past an id found in stored data, so it is never issued again
+    void observe(uint64_t id) {
+        if (id < ACCOUNT_ID_CHECKED_FROM) {
+            return;
+        }
+        lock_guard<mutex> guard(lock);
+        next = max(next, id / 10 + 1);
+    }
+};
+
+// Bank Management System
+class BankSystem {
+private:
+    AccountArena arena;                // owns every account; destroyed last
+    AccountIndex accounts;
+    TransactionJournal journal;        // this process's transactions the store may not hold yet
+    string adminPassword = "admin123";
+    TransactionLog log;
+    HistoryStore history;
+    unique_ptr<MappedSnapshot> mapped; // accounts not yet materialized
+    unique_ptr<SnapshotWarmer> warmer; // prefetches the mapped accounts, if started
+    DirtyTracker dirty;                // accounts changed since the last checkpoint
+    uint64_t baseCheckpointId = 0;     // id of the full snapshot loaded or last written
+    uint32_t deltaCount = 0;           // delta checkpoints on top of that snapshot
+    thread checkpointThread;           // background checkpoint writer, if one ran
+    mutex checkpointLock;
+    CheckpointStats lastCheckpoint;
+    thread compactionThread;           // background history compaction, if one ran
+    CompactionStats lastCompaction;
+    bool compactionDone = false;
+    AccountIdGenerator ids;
+    atomic<bool> closedSinceBase{false}; // an account was removed after the last full snapshot
+    map<uint64_t, vector<Transaction>> replayedHistory; // log transactions replayed at startup, by account
+
+    bool isAdmin(string password) {
+        return password == adminPassword;
+    }
+
+    // Connects an account to dirty tracking, the journal and whichever of
+    // the log and history store are open
+    void attachStorage(BankAccount* account) {
+        account->setDirtyTracker(&dirty);
+        account->setJournal(&journal);
+        if (log.isOpen()) {
+            account->setLog(&log);
+        }
+        if (history.isOpen()) {
+            account->setHistory(&history);
+        }
+    }
+
+    // Adds an account, replacing any account with the same number
+    void putAccount(BankAccount* account) {
+        BankAccount* previous = accounts.put(account->getId(), account);
+        if (previous) {
+            if (previous->isDirty()) {
+                dirty.remove(previous);
+            }
+            arena.destroy(previous);
+        }
+        ids.observe(account->getId());
+        attachStorage(account);
+    }
+
+    // Looks an account up, materializing it from the mapped snapshot on
+    // first access
+    BankAccount* findAccount(uint64_t id) {
+        if (BankAccount* account = accounts.find(id)) {
+            return account;
+        }
+        if (!mapped) {
+            return nullptr;
+        }
+        uint64_t index = mapped->find(formatAccountNumber(id));
+        if (index == mapped->size()) {
+            return nullptr;
+        }
+        BankAccount* account = warmer ? warmer->claim(index) : nullptr;
+        if (!account) {
+            account = mapped->materialize(index, arena);
+        }
+        if (account) {
+            accounts.put(id, account);
+            attachStorage(account);
+        }
+        return account;
+    }
+
+    // Bank-wide operations need every account in memory; this pulls in
+    // whatever the mapped snapshot still holds and releases the mapping
+    void materializeAll() {
+        if (!mapped) {
+            return;
+        }
+        if (warmer) {
+            warmer->stop();
+        }
+        for (uint64_t i = 0; i < mapped->size(); i++) {
+            BankAccount* account = warmer ? warmer->claim(i) : nullptr;
+            if (!account) {
+                account = mapped->materialize(i, arena);
+            }
+            if (!account) {
+                continue;
+            }
+            if (accounts.find(account->getId())) {
+                arena.destroy(account); // already materialized, memory copy is newer
+            } else {
+                accounts.put(account->getId(), account);
+                attachStorage(account);
+            }
+        }
+        warmer.reset();
+        mapped.reset();
+    }
+
+    // Copies what a snapshot holds of each account, so the copy can be
+    // serialized while the accounts keep changing
+    static AccountImage imageOf(const BankAccount* account) {
+        return AccountImage{account->getId(), account->getHolderNameHandle(), account->getAccountType(),
+                            account->getBalance().toCents(), account->getPin()};
+    }
+
+    static vector<AccountImage> captureAccounts(const vector<BankAccount*>& list) {
+        vector<AccountImage> images;
+        images.reserve(list.size());
+        for (const BankAccount* account : list) {
+            images.push_back(imageOf(account));
+        }
+        return images;
+    }
+
+    static void sortImages(vector<AccountImage>& images) {
+        sort(images.begin(), images.end(), [](const AccountImage& a, const AccountImage& b) {
+            return accountNumberLess(a.id, b.id);
+        });
+    }
+
+    // Serializes the given accounts (sorted by account number) into a
+    // snapshot image. Full snapshots carry baseId 0; deltas name the full
+    // snapshot they apply on top of.
+    static vector<char> buildSnapshot(const vector<AccountImage>& list,
+                                      uint64_t checkpointId, uint64_t baseId) {
+        SnapshotHeader header = {};
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.recordSize = sizeof(SnapshotRecord);
+        header.accountCount = list.size();
+        header.checkpointId = checkpointId;
+        header.baseId = baseId;
+
+        // Lay out the string table first so records can point into it:
+        // each distinct holder name once, as interned, then every record's
+        // number and PIN in record order
+        vector<SnapshotRecord> records;
+        records.reserve(list.size());
+        uint64_t offset = 0;
+        auto reserveString = [&offset](const string& s) {
+            uint64_t ref = offset;
+            offset += sizeof(uint32_t) + s.size();
+            return ref;
+        };
+        unordered_map<InternPool::Handle, uint64_t> nameRefs;
+        vector<InternPool::Handle> names;
+        for (const AccountImage& account : list) {
+            if (nameRefs.emplace(account.name, offset).second) {
+                names.push_back(account.name);
+                reserveString(holderNames().get(account.name));
+            }
+        }
+        for (const AccountImage& account : list) {
+            SnapshotRecord record = {};
+            record.numberRef = reserveString(formatAccountNumber(account.id));
+            record.nameRef = nameRefs[account.name];
+            record.pinRef = reserveString(account.pin);
+            record.type = account.type;
+            record.balance = account.cents;
+            records.push_back(record);
+        }
+        header.stringTableSize = offset;
+
+        vector<char> image;
+        image.reserve(sizeof(header) + records.size() * sizeof(SnapshotRecord) + offset);
+        putValue(image, header);
+        const char* recordBytes = reinterpret_cast<const char*>(records.data());
+        image.insert(image.end(), recordBytes, recordBytes + records.size() * sizeof(SnapshotRecord));
+        for (InternPool::Handle name : names) {
+            putString(image, holderNames().get(name));
+        }
+        for (const AccountImage& account : list) {
+            putString(image, formatAccountNumber(account.id));
+            putString(image, account.pin);
+        }
+
+        // Footer directory: records are sorted and their strings laid out
+        // in the same order, so each block's strings are one contiguous run
+        SnapshotTrailer trailer = {};
+        trailer.directoryOffset = image.size();
+        trailer.blockRecords = SNAPSHOT_INDEX_BLOCK;
+        for (size_t first = 0; first < list.size(); first += SNAPSHOT_INDEX_BLOCK) {
+            size_t end = min<size_t>(first + SNAPSHOT_INDEX_BLOCK, list.size());
+            uint64_t stringEnd = end < list.size() ? records[end].numberRef : offset;
+            putValue<uint64_t>(image, first);
+            putValue<uint64_t>(image, end - first);
+            putValue(image, records[first].numberRef);
+            putValue(image, stringEnd - records[first].numberRef);
+            putString(image, formatAccountNumber(list[first].id));
+            putString(image, formatAccountNumber(list[end - 1].id));
+            trailer.blockCount++;
+        }
+        trailer.directorySize = image.size() - trailer.directoryOffset;
+        memcpy(trailer.magic, SNAPSHOT_INDEX_MAGIC, sizeof(trailer.magic));
+        putValue(image, trailer);
+        appendSnapshotChecksums(image);
+        return image;
+    }
+
+    // Reads a snapshot file into the account map, replacing accounts with
+    // the same number. Fails without changing anything if the file is not
+    // a snapshot, or (when expectedBaseId is nonzero) is a delta for some
+    // other full snapshot.
+    bool readSnapshot(string filename, SnapshotHeader& header, uint64_t expectedBaseId = 0) {
+        ifstream file(filename, ios::binary | ios::ate);
+        if (!file.is_open()) {
+            return false;
+        }
+
+        streamsize fileSize = file.tellg();
+        file.seekg(0);
+        if (fileSize < static_cast<streamsize>(sizeof(SnapshotHeader))) {
+            cerr << "Snapshot " << filename << " is truncated.\n";
+            return false;
+        }
+
+        vector<char> data(fileSize);
+        for (streamsize done = 0; done < fileSize; ) {
+            streamsize chunk = min<streamsize>(SNAPSHOT_IO_BLOCK, fileSize - done);
+            if (!file.read(data.data() + done, chunk)) {
+                cerr << "Error reading snapshot " << filename << ".\n";
+                return false;
+            }
+            done += chunk;
+        }
+        file.close();
+
+        memcpy(&header, data.data(), sizeof(header));
+        if (!validateSnapshotHeader(header, fileSize, filename) ||
+            (expectedBaseId != 0 && header.baseId != expectedBaseId)) {
+            return false;
+        }
+
+        // Checksums are verified on the other cores while this thread
+        // parses; nothing is applied unless both succeed
+        int64_t damagedBlock = -1;
+        SnapshotChecksumTrailer checksums = {};
+        thread verifier;
+        if (header.version >= 4) {
+            const char* sums;
+            if (!locateSnapshotChecksums(data.data(), fileSize, filename, checksums, sums)) {
+                return false;
+            }
+            verifier = thread([&data, &damagedBlock, checksums, sums] {
+                damagedBlock = verifySnapshotChecksums(data.data(), checksums, sums);
+            });
+        }
+
+        const char* recordBase = data.data() + sizeof(header);
+        const char* table = recordBase + header.accountCount * sizeof(SnapshotRecord);
+        vector<BankAccount*> loaded;
+        string accNum, name, pin;
+        bool parsed = true;
+        // From version 6 records share name strings, so each distinct
+        // name is read and interned once
+        unordered_map<uint64_t, InternPool::Handle> nameHandles;
+        for (uint64_t i = 0; i < header.accountCount; i++) {
+            SnapshotRecord record;
+            memcpy(&record, recordBase + i * sizeof(SnapshotRecord), sizeof(record));
+            uint64_t id;
+            auto knownName = nameHandles.find(record.nameRef);
+            if (!readSnapshotString(table, header.stringTableSize, record.numberRef, accNum) ||
+                (knownName == nameHandles.end() &&
+                 !readSnapshotString(table, header.stringTableSize, record.nameRef, name)) ||
+                !readSnapshotString(table, header.stringTableSize, record.pinRef, pin) ||
+                record.type > CURRENT || !parseAccountNumber(accNum, id)) {
+                cerr << "Snapshot " << filename << " has a corrupt record at index " << i << ".\n";
+                parsed = false;
+                break;
+            }
+            InternPool::Handle nameHandle;
+            if (knownName != nameHandles.end()) {
+                nameHandle = knownName->second;
+            } else {
+                nameHandle = holderNames().intern(name);
+                if (header.version >= 6) {
+                    nameHandles.emplace(record.nameRef, nameHandle);
+                }
+            }
+            loaded.push_back(arena.create(id, nameHandle, pin,
+                                             static_cast<AccountType>(record.type),
+                                             snapshotBalance(record, header.version)));
+        }
+        if (verifier.joinable()) {
+            verifier.join();
+        }
+        if (damagedBlock >= 0) {
+            cerr << "Snapshot " << filename << " failed its checksum at offset "
+                 << damagedBlock * checksums.blockSize << ".\n";
+        }
+        if (!parsed || damagedBlock >= 0) {
+            for (BankAccount* account : loaded) {
+                arena.destroy(account);
+            }
+            return false;
+        }
+
+        for (BankAccount* account : loaded) {
+            putAccount(account);
+        }
+        return true;
+    }
+
+    static string deltaPath(const string& filename, uint32_t number) {
+        return filename + ".delta." + to_string(number);
+    }
+
+    // Applies the delta checkpoints written on top of the current full
+    // snapshot, in order. Deltas left over from an older full snapshot
+    // (a crash during consolidation) are ignored.
+    void loadDeltas(string filename) {
+        deltaCount = 0;
+        SnapshotHeader header;
+        while (readSnapshot(deltaPath(filename, deltaCount + 1), header, baseCheckpointId)) {
+            deltaCount++;
+        }
+    }
+
+    void removeDeltas(string filename) {
+        for (uint32_t number = 1; remove(deltaPath(filename, number).c_str()) == 0; number++) {
+        }
+    }
+
+    // Writes a file under a temporary name and renames it over the old one
+    // so a crash leaves either the old snapshot or the new one, never a
+    // half-written one or none at all
+    bool replaceFile(string filename, function<bool(string)> write) {
+        string tempFile = filename + ".tmp";
+        if (!write(tempFile)) {
+            remove(tempFile.c_str());
+            return false;
+        }
+        if (!replaceFileAtomically(tempFile, filename)) {
+            cerr << "Error replacing snapshot " << filename << ".\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Drops an account from memory. Closing is rare, so the rest of the
+    // mapped snapshot is pulled in first instead of tracking which mapped
+    // records are gone, and the next checkpoint is a full one because a
+    // delta cannot express a removal.
+    void removeAccount(BankAccount* account) {
+        materializeAll();
+        if (account->isDirty()) {
+            dirty.remove(account);
+        }
+        accounts.erase(account->getId());
+        arena.destroy(account);
+        closedSinceBase = true;
+    }
+
+public:
+    // Accounts live in a slab arena, optionally backed by huge pages
+    explicit BankSystem(bool hugePages = false) : arena(hugePages) {}
+
+    // Accounts are released with the arena, a slab at a time
+    ~BankSystem() {
+        warmer.reset();
+        waitForCheckpoint();
+        if (compactionThread.joinable()) {
+            compactionThread.join();
+        }
+    }
+
+    BankAccount* createAccount(string name, string pin, AccountType type, Money initialDeposit = Money()) {
+        uint64_t id = ids.nextId();
+        // Only a lost id state file could hand out a number already in use
+        while (findAccount(id)) {
+            id = ids.nextId();
+        }
+        // Logged first, so a failed write leaves no unlogged account behind
+        if (log.isOpen()) {
+            log.logCreate(formatAccountNumber(id), name, pin, type, initialDeposit);
+        }
+        BankAccount* account = arena.create(id, name, pin, type, initialDeposit);
+        accounts.put(id, account);
+        attachStorage(account);
+        account->markDirty();
+        return account;
+    }
+
+    BankAccount* login(uint64_t accountId, string pin, int& attemptsLeft) {
+        BankAccount* account = findAccount(accountId);
+        if (account) {
+            if (account->verifyPin(pin)) {
+                attemptsLeft = MAX_LOGIN_ATTEMPTS;
+                return account;
+            } else {
+                attemptsLeft--;
+                if (attemptsLeft <= 0) {
+                    cout << "Too many failed attempts. Account temporarily locked.\n";
+                }
+                return nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    bool transfer(BankAccount* from, uint64_t toAccountId, Money amount) {
+        BankAccount* to = findAccount(toAccountId);
+        // Checked first so an amount the payee cannot hold is never withdrawn
+        if (to && !to->getBalance().canAdd(amount)) {
+            throw overflow_error("Transfer would take the payee's balance out of range");
+        }
+        if (to && from->withdraw(amount, KIND_TRANSFER_OUT, to->getId())) {
+            try {
+                to->deposit(amount, KIND_TRANSFER_IN, from->getId());
+            } catch (const exception&) {
+                // The withdrawal is already logged, so it is undone by a
+                // logged refund rather than by rewriting the balance
+                from->deposit(amount, KIND_TRANSFER_IN, to->getId());
+                throw;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // Closes an account, paying out what is left as a final withdrawal so
+    // the payout is on record. Returns the amount paid out. Closing is the
+    // only way an account is destroyed, and so the only source of the
+    // arena slots its free list hands out again.
+    Money closeAccount(BankAccount* account) {
+        Money payout = account->getBalance();
+        if (payout > Money()) {
+            account->withdraw(payout);
+        }
+        if (log.isOpen()) {
+            log.logClose(account->getAccountNumber());
+        }
+        removeAccount(account);
+        return payout;
+    }
+
+    void applyMonthlyInterest() {
+        materializeAll();
+        postMonthlyInterest(arena);
+        cout << "Monthly interest applied to all accounts.\n";
+    }
+
+    BankTotals totals() {
+        materializeAll();
+        return sumAccounts(arena);
+    }
+
+    void printAllAccounts(string adminPassword) {
+        if (!isAdmin(adminPassword)) {
+            cout << "Unauthorized access!\n";
+            return;
+        }
+        materializeAll();
+
+        cout << "\nAll Accounts Summary\n";
+        cout << "--------------------------------------------------\n";
+        cout << "Account Number | Holder Name       | Type     | Balance\n";
+        cout << "--------------------------------------------------\n";
+
+        for (BankAccount* account : accounts.sorted()) {
+            cout << account->getAccountNumber() << " | " << setw(17) << left << account->getHolderName() << " | ";
+            cout << (account->getAccountType() == SAVINGS ? "Savings " : "Current ") << " | $";
+            cout << account->getBalance() << endl;
+        }
+        cout << "--------------------------------------------------\n";
+        BankTotals sums = totals();
+        cout << sums.savings + sums.current << " accounts (" << sums.savings << " savings, "
+             << sums.current << " current), total balance $" << sums.balance << "\n";
+    }
+
+    // Writes a full binary snapshot of all accounts. It goes through the
+    // checkpoint path, so the file is replaced atomically and the deltas
+    // and log records it covers are dropped along with it.
+    void saveToFile(string filename) {
+        checkpoint(filename, true);
+    }
+
+    // Maps a snapshot written by saveToFile without reading it; accounts
+    // are materialized as login and transfer touch them. Delta checkpoints
+    // on top of it are read in full. With `warm` set, a background thread
+    // materializes the rest ahead of use. Returns false if the file is
+    // missing or not a valid snapshot.
+    bool mapFromFile(string filename, bool warm = false) {
+        waitForCheckpoint();
+        materializeAll();
+        unique_ptr<MappedSnapshot> snapshot(new MappedSnapshot());
+        if (!snapshot->open(filename)) {
+            return false;
+        }
+        baseCheckpointId = snapshot->getHeader().checkpointId;
+        mapped = move(snapshot);
+        loadDeltas(filename);
+        if (warm) {
+            warmer.reset(new SnapshotWarmer(*mapped, arena));
+        }
+        return true;
+    }
+
+    // Waits for the warmer to reach every mapped account, then moves them
+    // all into memory
+    void waitForWarmer() {
+        while (warmer && !warmer->finished()) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        materializeAll();
+    }
+
+    void printWarmerStats() {
+        if (!warmer) {
+            cout << "All accounts are in memory.\n";
+            return;
+        }
+        cout << "Snapshot warmer: " << warmer->progress() << " of " << mapped->size()
+             << " accounts prefetched";
+        if (warmer->finished()) {
+            cout << " in " << fixed << setprecision(2) << warmer->elapsedSeconds() << "s";
+        }
+        cout << "\n";
+    }
+
+    // Loads a binary snapshot written by saveToFile, plus any delta
+    // checkpoints on top of it. Returns false if the file is missing or
+    // not a valid snapshot.
+    bool loadFromFile(string filename) {
+        waitForCheckpoint();
+        SnapshotHeader header;
+        if (!readSnapshot(filename, header)) {
+            return false;
+        }
+        baseCheckpointId = header.checkpointId;
+        loadDeltas(filename);
+        return true;
+    }
+
+    // Prints one account from a snapshot and its delta checkpoints using
+    // their footer directories, without loading any other account. The
+    // newest delta holding the account wins. Returns false if not found.
+    static bool lookupAccount(string filename, string accNum) {
+        auto start = chrono::steady_clock::now();
+        SnapshotIndex index;
+        if (!index.open(filename)) {
+            cerr << "Cannot read snapshot " << filename << ".\n";
+            return false;
+        }
+        uint64_t baseId = index.getHeader().checkpointId;
+        SnapshotRecord record;
+        string name, pin;
+        bool found = index.lookup(accNum, record, name, pin);
+        Money balance = found ? snapshotBalance(record, index.getHeader().version) : Money();
+        string source = filename;
+        uint64_t bytesRead = index.getBytesRead();
+
+        SnapshotIndex delta;
+        for (uint32_t number = 1; delta.open(deltaPath(filename, number)) &&
+                                  delta.getHeader().baseId == baseId; number++) {
+            SnapshotRecord deltaRecord;
+            string deltaName, deltaPin;
+            if (delta.lookup(accNum, deltaRecord, deltaName, deltaPin)) {
+                found = true;
+                record = deltaRecord;
+                balance = snapshotBalance(deltaRecord, delta.getHeader().version);
+                name = deltaName;
+                source = deltaPath(filename, number);
+            }
+            bytesRead += delta.getBytesRead();
+        }
+        double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        if (!found) {
+            cout << "Account " << accNum << " not found in " << filename << ".\n";
+            return false;
+        }
+        cout << "Account Number | Holder Name       | Type     | Balance\n";
+        cout << accNum << " | " << setw(17) << left << name << " | ";
+        cout << (record.type == SAVINGS ? "Savings " : "Current ") << " | $";
+        cout << balance << "\n";
+        cout << "(from " << source << ", read " << bytesRead << " bytes in "
+             << setprecision(3) << millis << " ms)\n";
+        return true;
+    }
+
+    // Persists everything changed since the last checkpoint and drops the
+    // log records it now covers, waiting until the files are on disk.
+    void checkpoint(string filename, bool consolidate = false) {
+        startCheckpoint(filename, consolidate);
+        waitForCheckpoint();
+    }
+
+    // Background checkpoint. The foreground only rotates the log and
+    // copies the fields a snapshot holds out of the accounts to write (a
+    // few dozen bytes each); a background thread sorts and serializes the
+    // copy, then writes and fsyncs it while the bank keeps taking
+    // deposits, withdrawals and transfers.
+    //
+    // Normally only dirty accounts are written, as the next delta file; a
+    // full snapshot replaces the base and its deltas when there is no base
+    // yet, when MAX_DELTA_CHECKPOINTS deltas have piled up, or when
+    // `consolidate` is set. With nothing dirty no delta is written and
+    // only the rotated log is dropped, so idle checkpoints cost nothing.
+    // Log records written after the rotation are replayed over the new
+    // checkpoint on recovery, which is safe because they carry absolute
+    // balances.
+    void startCheckpoint(string filename, bool consolidate = false) {
+        waitForCheckpoint();
+        auto start = chrono::steady_clock::now();
+        log.rotate();
+
+        // Flags are cleared up front so a change made while the file is
+        // being written marks the account again for the next checkpoint
+        vector<BankAccount*> changed = dirty.take();
+        for (BankAccount* account : changed) {
+            account->clearDirty();
+        }
+        bool removed = closedSinceBase.exchange(false);
+        bool full = consolidate || removed || baseCheckpointId == 0 || deltaCount >= MAX_DELTA_CHECKPOINTS;
+
+        vector<AccountImage> images;
+        if (full) {
+            materializeAll();
+            images.reserve(accounts.size());
+            accounts.forEach([&images](BankAccount* account) {
+                images.push_back(imageOf(account));
+            });
+        } else {
+            images = captureAccounts(changed);
+        }
+        size_t accountCount = images.size();
+        uint64_t checkpointId = full ? baseCheckpointId + 1 : deltaCount + 1;
+        uint64_t baseId = full ? 0 : baseCheckpointId;
+        string target = full ? filename : deltaPath(filename, deltaCount + 1);
+        double captureMillis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        checkpointThread = thread([this, filename, target, full, accountCount, captureMillis, checkpointId,
+                                   baseId, images = move(images)]() mutable {
+            auto writeStart = chrono::steady_clock::now();
+            bool written = true;
+            if (full || !images.empty()) {
+                sortImages(images);
+                vector<char> image = buildSnapshot(images, checkpointId, baseId);
+                written = replaceFile(target, [&image](string tempFile) {
+                    return writeFileDurably(tempFile, image);
+                });
+            }
+            if (written) {
+                if (full) {
+                    baseCheckpointId++;
+                    removeDeltas(filename);
+                    deltaCount = 0;
+                } else if (!images.empty()) {
+                    deltaCount++;
+                }
+                // The rotated log can rebuild history records that have not
+                // reached the disk yet, so it is kept until they have. The
+                // journal entries the store then holds are freed too.
+                uint64_t journaled = journal.size();
+                bool historyOpen = history.isOpen();
+                if (history.sync()) {
+                    log.discardRotated();
+                    if (historyOpen) {
+                        journal.retire(journaled);
+                    }
+                }
+            } else {
+                // The accounts may have changed or closed since, so rather
+                // than re-marking them the next checkpoint is a full one
+                closedSinceBase = true;
+            }
+
+            lock_guard<mutex> guard(checkpointLock);
+            lastCheckpoint.full = full;
+            lastCheckpoint.succeeded = written;
+            lastCheckpoint.accounts = accountCount;
+            lastCheckpoint.captureMillis = captureMillis;
+            lastCheckpoint.writeMillis =
+                chrono::duration<double, milli>(chrono::steady_clock::now() - writeStart).count();
+            lastCheckpoint.completed = true;
+        });
+    }
+
+    void waitForCheckpoint() {
+        if (checkpointThread.joinable()) {
+            checkpointThread.join();
+        }
+    }
+
+    // Compacts transaction history older than HISTORY_RETENTION_DAYS on a
+    // background thread, throttled to COMPACTION_BYTES_PER_SEC
+    void startHistoryCompaction() {
+        if (compactionThread.joinable()) {
+            compactionThread.join();
+        }
+        time_t horizon = time(nullptr) - HISTORY_RETENTION_DAYS * 24 * 60 * 60;
+        compactionThread = thread([this, horizon] {
+            CompactionStats stats = history.compact(horizon, COMPACTION_BYTES_PER_SEC);
+            lock_guard<mutex> guard(checkpointLock);
+            lastCompaction = stats;
+            compactionDone = true;
+        });
+    }
+
+    void printCompactionStats() {
+        lock_guard<mutex> guard(checkpointLock);
+        if (!compactionDone) {
+            cout << "No history compaction has completed yet.\n";
+            return;
+        }
+        cout << "Last compaction: " << lastCompaction.segmentsIn << " segments ("
+             << lastCompaction.recordsIn << " records, " << lastCompaction.bytesIn << " bytes) -> "
+             << lastCompaction.segmentsOut << " segments (" << lastCompaction.recordsOut
+             << " records, " << lastCompaction.bytesOut << " bytes)\n";
+    }
+
+    void printCheckpointStats() {
+        lock_guard<mutex> guard(checkpointLock);
+        if (!lastCheckpoint.completed) {
+            cout << "No checkpoint has completed yet.\n";
+            return;
+        }
+        cout << "Last checkpoint: " << (lastCheckpoint.full ? "full" : "delta") << ", "
+             << lastCheckpoint.accounts << " accounts, "
+             << (lastCheckpoint.succeeded ? "succeeded" : "FAILED") << "\n";
+        cout << "Foreground capture: " << fixed << setprecision(2) << lastCheckpoint.captureMillis
+             << "ms, background write: " << lastCheckpoint.writeMillis << "ms\n";
+    }
+
+    // Replays the write-ahead log over the loaded snapshot, then keeps it
+    // open so every later mutation is appended to it
+    void openLog(string filename) {
+        // A rotated log holds records older than the current one
+        size_t replayed = 0;
+        for (string name : {TransactionLog::rotatedName(filename), filename}) {
+            replayed += TransactionLog::replay(name, [this](ByteReader& reader) {
+                return replayLogRecord(reader);
+            });
+        }
+        if (replayed > 0) {
+            cout << "Recovered " << replayed << " logged changes.\n";
+        }
+        restoreHistory();
+
+        if (!log.open(filename)) {
+            cerr << "Error opening transaction log " << filename << ".\n";
+            return;
+        }
+        accounts.forEach([this](BankAccount* account) { attachStorage(account); });
+    }
+
+    // Opens the segmented transaction history so statements survive restarts
+    void openHistory(string prefix) {
+        if (!history.open(prefix)) {
+            cerr << "Error opening transaction history " << prefix << ".\n";
+            return;
+        }
+        accounts.forEach([this](BankAccount* account) { attachStorage(account); });
+    }
+
+    // Persists the account id generator so numbers are not reissued after
+    // a restart
+    void openIdGenerator(string filename) {
+        if (!ids.open(filename)) {
+            cerr << "Error opening account id state " << filename << ".\n";
+        }
+    }
+
+    // History records are appended after their log records are durable,
+    // so a crash can leave the store missing the newest few of an
+    // account's logged transactions. The store then ends with some prefix
+    // of the transactions replayed for that account; the rest are
+    // appended now.
+    void restoreHistory() {
+        if (history.isOpen()) {
+            for (const auto& entry : replayedHistory) {
+                const vector<Transaction>& logged = entry.second;
+                vector<Transaction> stored = history.recent(entry.first, logged.size());
+                size_t present = stored.size();
+                while (present > 0 &&
+                       !equal(stored.end() - present, stored.end(), logged.begin(), sameTransaction)) {
+                    present--;
+                }
+                for (size_t i = present; i < logged.size(); i++) {
+                    history.append(entry.first, logged[i]);
+                }
+            }
+        }
+        replayedHistory.clear();
+    }
+
+    bool replayLogRecord(ByteReader& reader) {
+        uint8_t kind;
+        string accNum;
+        uint64_t id;
+        if (!reader.get(kind) || !reader.getString(accNum) || !parseAccountNumber(accNum, id)) {
+            return false;
+        }
+        bool cents = kind & LOG_CENTS;
+        kind &= ~LOG_CENTS;
+
+        if (kind == LOG_CREATE) {
+            string name, pin;
+            uint32_t type;
+            Money balance;
+            if (!reader.getString(name) || !reader.getString(pin) ||
+                !reader.get(type) || !reader.getMoney(balance, cents) || type > CURRENT) {
+                return false;
+            }
+            // Already present if the snapshot was written after this record
+            if (!findAccount(id)) {
+                BankAccount* account = arena.create(id, name, pin, static_cast<AccountType>(type),
+                                                     balance);
+                accounts.put(id, account);
+                attachStorage(account);
+                account->markDirty();
+            }
+            ids.observe(id);
+            return true;
+        }
+
+        BankAccount* account = findAccount(id);
+        if (kind == LOG_CLOSE) {
+            // Already gone if the snapshot was written after this record
+            if (account) {
+                removeAccount(account);
+            }
+            return true;
+        }
+        if (!account) {
+            return false;
+        }
+
+        if (kind == LOG_TRANSACTION) {
+            Transaction t;
+            int64_t timestamp;
+            string_view text;
+            if (!reader.get(timestamp) || !reader.getMoney(t.amount, cents) ||
+                !reader.getMoney(t.balanceAfter, cents) || !reader.getStringView(text)) {
+                return false;
+            }
+            t.timestamp = timestamp;
+            parseTransactionText(text, t);
+            account->restoreTransaction(t);
+            replayedHistory[account->getId()].push_back(t);
+            return true;
+        }
+
+        if (kind == LOG_PIN) {
+            string pin;
+            if (!reader.getString(pin)) {
+                return false;
+            }
+            account->restorePin(pin);
+            return true;
+        }
+        return false;
+    }
+
+    void configureLog(size_t maxBatchRecords, chrono::microseconds maxBatchWait) {
+        log.setGroupCommit(maxBatchRecords, maxBatchWait);
+    }
+
+    void printLogStats() {
+        log.printStats();
+        size_t pending = history.pendingCount();
+        if (pending > 0) {
+            cout << "History store: " << pending << " transactions waiting for a writable segment\n";
+        }
+    }
+
+    // Writes accounts as comma-separated text
+    void exportCsv(string filename) {
+        ofstream file(filename);
+        if (!file.is_open()) {
+            cerr << "Error exporting data to file.\n";
+            return;
+        }
+        materializeAll();
+
+        arena.forEach([&](BankAccount* account) {
+            file << account->getAccountNumber() << ","
+                 << csvQuote(account->getHolderName()) << ","
+                 << account->getAccountType() << ","
+                 << account->getBalance() << "\n";
+        });
+        file.close();
+    }
+
+    // Writes every stored transaction to a columnar ledger file, streaming
+    // them out of the history store (or, without one, the journal, which
+    // then holds every transaction of this process in the order they
+    // happened) a row group at a time. Returns the number of rows written.
+    uint64_t exportLedger(string filename) {
+        LedgerWriter writer;
+        if (!writer.open(filename)) {
+            return 0;
+        }
+        uint64_t rows = 0;
+        auto add = [&writer, &rows](uint64_t accountId, const Transaction& t) {
+            writer.add(formatAccountNumber(accountId), t);
+            rows++;
+        };
+        if (history.isOpen()) {
+            history.forEachTransaction(add);
+        } else {
+            journal.forEach(add);
+        }
+        return writer.close() ? rows : 0;
+    }
+
+    // Imports accounts from comma-separated text written by exportCsv.
+    // The file is split into newline-aligned chunks that are parsed on
+    // separate threads; if an account number appears more than once the
+    // last occurrence in the file wins, as it would reading sequentially.
+    void importCsv(string filename) {
+        ifstream file(filename, ios::binary | ios::ate);
+        if (!file.is_open()) {
+            cerr << "No existing data file found. Starting fresh.\n";
+            return;
+        }
+        materializeAll();
+
+        size_t fileSize = static_cast<size_t>(file.tellg());
+        file.seekg(0);
+        vector<char> data(fileSize);
+        for (size_t done = 0; done < fileSize; ) {
+            size_t chunk = min(SNAPSHOT_IO_BLOCK, fileSize - done);
+            if (!file.read(data.data() + done, chunk)) {
+                cerr << "Error reading " << filename << ".\n";
+                return;
+            }
+            done += chunk;
+        }
+        file.close();
+
+        // Chunk boundaries always sit just past a newline
+        size_t chunkCount = min<size_t>(max(1u, thread::hardware_concurrency()),
+                                        fileSize / CSV_MIN_CHUNK_BYTES + 1);
+        vector<size_t> bounds(chunkCount + 1, fileSize);
+        bounds[0] = 0;
+        for (size_t i = 1; i < chunkCount; i++) {
+            size_t pos = max(bounds[i - 1], fileSize * i / chunkCount);
+            while (pos < fileSize && pos > 0 && data[pos - 1] != '\n') {
+                pos++;
+            }
+            bounds[i] = pos;
+        }
+
+        vector<vector<BankAccount*>> parsed(chunkCount);
+        vector<size_t> skipped(chunkCount, 0);
+        auto parseChunk = [&](size_t chunk) {
+            const char* cursor = data.data() + bounds[chunk];
+            const char* end = data.data() + bounds[chunk + 1];
+            string scratch;
+            while (cursor < end) {
+                const char* newline = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+                string_view line(cursor, (newline ? newline : end) - cursor);
+                cursor = newline ? newline + 1 : end;
+                if (!line.empty() && line.back() == '\r') {
+                    line.remove_suffix(1);
+                }
+                if (line.empty()) {
+                    continue;
+                }
+                BankAccount* account = parseCsvLine(line, scratch, arena);
+                if (account) {
+                    parsed[chunk].push_back(account);
+                } else {
+                    skipped[chunk]++;
+                }
+            }
+        };
+
+        vector<thread> workers;
+        for (size_t i = 1; i < chunkCount; i++) {
+            workers.emplace_back(parseChunk, i);
+        }
+        parseChunk(0);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        // Merge in file order so later duplicates replace earlier ones
+        size_t skippedLines = 0;
+        size_t incoming = 0;
+        for (size_t i = 0; i < chunkCount; i++) {
+            incoming += parsed[i].size();
+            skippedLines += skipped[i];
+        }
+        accounts.reserve(accounts.size() + incoming);
+        for (size_t i = 0; i < chunkCount; i++) {
+            for (BankAccount* account : parsed[i]) {
+                // Imported accounts are not in any snapshot yet; a later
+                // duplicate takes the earlier one back out of the dirty set
+                putAccount(account);
+                account->markDirty();
+            }
+        }
+        if (skippedLines > 0) {
+            cerr << "Skipped " << skippedLines << " malformed lines in " << filename << ".\n";
+        }
+    }
+
+    // Parses one exported account line, or returns nullptr if malformed.
+    // Fields are scanned in place; `scratch` is only used to unescape a
+    // quoted holder name containing doubled quotes.
+    static BankAccount* parseCsvLine(string_view line, string& scratch, AccountArena& arena) {
+        string_view accNum, name, typeField, balanceField;
+        uint64_t id;
+        if (!nextCsvField(line, accNum, scratch) || !parseAccountNumber(accNum, id) ||
+            !nextCsvField(line, name, scratch)) {
+            return nullptr;
+        }
+        // Interned before the next field can reuse the scratch buffer
+        InternPool::Handle holderName = holderNames().intern(name);
+        if (!nextCsvField(line, typeField, scratch) || !nextCsvField(line, balanceField, scratch) ||
+            line.data() != nullptr) {
+            return nullptr;
+        }
+
+        int type;
+        Money balance;
+        if (!parseNumber(typeField, type) || !parseBalance(balanceField, balance) ||
+            (type != SAVINGS && type != CURRENT)) {
+            return nullptr;
+        }
+        // CSV exports carry no PINs or transactions
+        return arena.create(id, holderName, "0000", static_cast<AccountType>(type), balance);
+    }
+
+    // Splits the next field off the front of `rest`, consuming the comma
+    // after it. Returns false on an unterminated quote. A line that has
+    // run out of fields yields false as well.
+    static bool nextCsvField(string_view& rest, string_view& field, string& scratch) {
+        if (rest.data() == nullptr) {
+            return false;
+        }
+        if (rest.empty() || rest.front() != '"') {
+            size_t comma = rest.find(',');
+            field = rest.substr(0, comma);
+            rest = comma == string_view::npos ? string_view() : rest.substr(comma + 1);
+            return true;
+        }
+
+        // Quoted field: "" stands for a literal quote
+        size_t close = 1;
+        bool escaped = false;
+        while (true) {
+            close = rest.find('"', close);
+            if (close == string_view::npos) {
+                return false;
+            }
+            if (close + 1 < rest.size() && rest[close + 1] == '"') {
+                escaped = true;
+                close += 2;
+                continue;
+            }
+            break;
+        }
+        field = rest.substr(1, close - 1);
+        if (escaped) {
+            scratch.clear();
+            for (size_t i = 0; i < field.size(); i++) {
+                scratch += field[i];
+                if (field[i] == '"') {
+                    i++;
+                }
+            }
+            field = scratch;
+        }
+
+        rest.remove_prefix(close + 1);
+        if (rest.empty()) {
+            rest = string_view();
+        } else if (rest.front() == ',') {
+            rest.remove_prefix(1);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    template <typename T>
+    static bool parseNumber(string_view text, T& value) {
+        const char* end = text.data() + text.size();
+        auto result = from_chars(text.data(), end, value);
+        return result.ec == errc() && result.ptr == end;
+    }
+
+    // Balances are exported as plain decimals; exports from before
+    // balances were held in cents may use the shortest double form,
+    // exponent included, so fall back to that
+    static bool parseBalance(string_view text, Money& balance) {
+        if (Money::parse(text, balance)) {
+            return true;
+        }
+        double value;
+        if (!parseNumber(text, value)) {
+            return false;
+        }
+        try {
+            balance = Money::fromDouble(value);
+        } catch (const overflow_error&) {
+            return false;
+        }
+        return true;
+    }
+};
+
+// Helper functions
+void displayMainMenu() {
+    cout << "\nBanking Management System\n";
+    cout << "1. Create Account\n";
+    cout << "2. Login\n";
+    cout << "3. Admin Functions\n";
+    cout << "4. Exit\n";
+    cout << "Enter choice: ";
+}
+
+void displayCustomerMenu() {
+    cout << "\nCustomer Menu\n";
+    cout << "1. Deposit\n";
+    cout << "2. Withdraw\n";
+    cout << "3. Transfer\n";
+    cout << "4. View Statement\n";
+    cout << "5. Change PIN\n";
+    cout << "6. Close Account\n";
+    cout << "7. Logout\n";
+    cout << "Enter choice: ";
+}
+
+void displayAdminMenu() {
+    cout << "\nAdmin Menu\n";
+    cout << "1. Apply Monthly Interest\n";
+    cout << "2. View All Accounts\n";
+    cout << "3. Export Accounts to CSV\n";
+    cout << "4. View Storage Statistics\n";
+    cout << "5. Compact Transaction History\n";
+    cout << "6. Export Ledger for Analytics\n";
+    cout << "7. Back to Main Menu\n";
+    cout << "Enter choice: ";
+}
+
+AccountType getAccountType() {
+    int type;
+    while (true) {
+        cout << "Account Type:\n";
+        cout << "1. Savings Account (4% annual interest)\n";
+        cout << "2. Current Account (1% annual interest)\n";
+        cout << "Enter choice: ";
+        cin >> type;
+        
+        if (type == 1 || type == 2) {
+            return type == 1 ? SAVINGS : CURRENT;
+        }
+        cout << "Invalid choice. Please try again.\n";
+    }
+}
+
+string getPin() {
+    string pin;
+    while (true) {
+        cout << "Enter 4-digit PIN: ";
+        cin >> pin;
+        
+        if (pin.length() == 4 && all_of(pin.begin(), pin.end(), ::isdigit)) {
+            return pin;
+        }
+        cout << "PIN must be 4 digits. Try again.\n";
+    }
+}
+
+// Reads a non-negative amount of at most two decimal places
+Money getAmount(const string& prompt, bool allowZero = false) {
+    string text;
+    while (true) {
+        cout << prompt;
+        cin >> text;
+
+        size_t point = text.find('.');
+        Money amount;
+        if ((point == string::npos || text.size() - point <= 3) && Money::parse(text, amount) &&
+            (allowZero ? amount >= Money() : amount > Money()) && amount <= Money::fromCents(MAX_AMOUNT_CENTS)) {
+            return amount;
+        }
+        cout << "Amount must be a number such as 25 or 25.50, " << (allowZero ? "at least 0" : "more than 0")
+             << " and at most $" << Money::fromCents(MAX_AMOUNT_CENTS) << ". Try again.\n";
+    }
+}
+
+// Tells the user an operation was refused or could not be completed,
+// such as when the transaction log cannot be written
+void reportFailure(const exception& error) {
+    cerr << "Operation failed: " << error.what() << "\n";
+}
+
+// Parses an account number typed by a user, rejecting malformed ones and
+// ones whose check digit does not match
+bool parseTypedAccountNumber(const string& text, uint64_t& id) {
+    if (parseAccountNumber(text, id) && isValidAccountId(id)) {
+        return true;
+    }
+    cout << "Invalid account number " << text << ".\n";
+    return false;
+}
+
+// Benchmarks
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+long long fileSize(string filename) {
+    ifstream file(filename, ios::binary | ios::ate);
+    return file.is_open() ? static_cast<long long>(file.tellg()) : -1;
+}
+
+// Builds a bank of synthetic accounts for benchmarking
+void populateBank(BankSystem& bank, long long count) {
+    const char* names[] = {"Alice Smith", "Bob Jones", "Carol White", "Dan Brown", "Eve Black"};
+    for (long long i = 0; i < count; i++) {
+        bank.createAccount(names[i % 5], "1234", i % 3 == 0 ? CURRENT : SAVINGS, Money::fromCents((i % 100000) * 125));
+    }
+}
+
+// Compares load time and file size of the CSV and binary snapshot formats
+void benchmarkSnapshotFormats(long long count) {
+    string csvFile = "bench_accounts.txt";
+    string snapshotFile = "bench_accounts.dat";
+    {
+        BankSystem bank;
+        populateBank(bank, count);
+        bank.exportCsv(csvFile);
+        bank.saveToFile(snapshotFile);
+    }
+
+    auto start = chrono::steady_clock::now();
+    {
+        BankSystem bank;
+        bank.importCsv(csvFile);
+    }
+    double csvLoad = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    {
+        BankSystem bank;
+        bank.loadFromFile(snapshotFile);
+    }
+    double snapshotLoad = secondsSince(start);
+
+    cout << "accounts=" << count << "\n";
+    cout << "  csv      load " << fixed << setprecision(3) << csvLoad << "s  size "
+         << fileSize(csvFile) << " bytes\n";
+    cout << "  snapshot load " << fixed << setprecision(3) << snapshotLoad << "s  size "
+         << fileSize(snapshotFile) << " bytes\n";
+
+    remove(csvFile.c_str());
+    remove(snapshotFile.c_str());
+}
+
+// The stringstream/stoi/stod line parser importCsv used before the
+// in-place scanner, kept as the baseline for benchmarkCsvParse
+bool parseCsvLineLegacy(const string& line, string& accNum, string& name, int& type, double& balance) {
+    stringstream ss(line);
+    string typeStr, balanceStr;
+    getline(ss, accNum, ',');
+    getline(ss, name, ',');
+    getline(ss, typeStr, ',');
+    getline(ss, balanceStr);
+    try {
+        type = stoi(typeStr);
+        balance = stod(balanceStr);
+    } catch (const logic_error&) {
+        return false;
+    }
+    return true;
+}
+
+// Compares CSV parse throughput of the legacy and in-place parsers
+void benchmarkCsvParse(long long count) {
+    string text;
+    for (long long i = 0; i < count; i++) {
+        text += "ACCT" + to_string(1001 + i) + ",Holder " + to_string(i % 977) + "," +
+                to_string(i % 2) + "," + to_string((i % 100000) * 1.25) + "\n";
+    }
+    double megabytes = text.size() / 1e6;
+
+    auto start = chrono::steady_clock::now();
+    size_t legacyRows = 0;
+    {
+        istringstream in(text);
+        string line, accNum, name;
+        int type;
+        double balance;
+        while (getline(in, line)) {
+            legacyRows += parseCsvLineLegacy(line, accNum, name, type, balance);
+        }
+    }
+    double legacySeconds = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    size_t rows = 0;
+    {
+        AccountArena arena;
+        string scratch;
+        string_view rest(text);
+        while (!rest.empty()) {
+            size_t newline = rest.find('\n');
+            string_view line = rest.substr(0, newline);
+            rest = newline == string_view::npos ? string_view() : rest.substr(newline + 1);
+            BankAccount* account = BankSystem::parseCsvLine(line, scratch, arena);
+            rows += account != nullptr;
+            arena.destroy(account);
+        }
+    }
+    double seconds = secondsSince(start);
+
+    cout << "rows=" << count << " (" << fixed << setprecision(1) << megabytes << " MB)\n";
+    cout << "  stringstream parser " << fixed << setprecision(1) << megabytes / legacySeconds
+         << " MB/s (" << legacyRows << " rows)\n";
+    cout << "  in-place parser     " << fixed << setprecision(1) << megabytes / seconds
+         << " MB/s (" << rows << " rows, including account construction)\n";
+}
+
+// Compares time to first login after a CSV import, a full snapshot load
+// and a mapped snapshot
+void benchmarkStartup(long long count) {
+    string csvFile = "bench_accounts.txt";
+    string snapshotFile = "bench_accounts.dat";
+    {
+        BankSystem bank;
+        populateBank(bank, count);
+        bank.exportCsv(csvFile);
+        bank.saveToFile(snapshotFile);
+    }
+
+    auto timeStartup = [](function<void(BankSystem&)> load) {
+        auto start = chrono::steady_clock::now();
+        BankSystem bank;
+        load(bank);
+        int attempts = MAX_LOGIN_ATTEMPTS;
+        bank.login(makeAccountId(FIRST_ACCOUNT_SEQUENCE), "1234", attempts);
+        return secondsSince(start);
+    };
+    double csvStartup = timeStartup([&](BankSystem& bank) { bank.importCsv(csvFile); });
+    double loadStartup = timeStartup([&](BankSystem& bank) { bank.loadFromFile(snapshotFile); });
+    double mapStartup = timeStartup([&](BankSystem& bank) { bank.mapFromFile(snapshotFile); });
+
+    // With the warmer, time the first login alone, then how long logins
+    // take while it runs and how long it needs to reach every account
+    double firstLogin, warmingLogin, warmSeconds;
+    {
+        // The runs above freed millions of small blocks; an untimed startup
+        // lets the allocator sort them out before the timed one
+        {
+            BankSystem untimed;
+            untimed.mapFromFile(snapshotFile, true);
+        }
+
+        auto start = chrono::steady_clock::now();
+        BankSystem bank;
+        bank.mapFromFile(snapshotFile, true);
+        int attempts = MAX_LOGIN_ATTEMPTS;
+        bank.login(makeAccountId(FIRST_ACCOUNT_SEQUENCE), "1234", attempts);
+        firstLogin = secondsSince(start);
+
+        const int probes = 1000;
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < probes; i++) {
+            attempts = MAX_LOGIN_ATTEMPTS;
+            bank.login(makeAccountId(FIRST_ACCOUNT_SEQUENCE + (i * 7919LL) % count), "1234", attempts);
+        }
+        warmingLogin = secondsSince(start) / probes;
+        start = chrono::steady_clock::now();
+        bank.waitForWarmer();
+        warmSeconds = secondsSince(start);
+    }
+
+    cout << "accounts=" << count << " (startup to first login, including teardown)\n";
+    cout << "  csv import     " << fixed << setprecision(4) << csvStartup << "s\n";
+    cout << "  snapshot load  " << fixed << setprecision(4) << loadStartup << "s\n";
+    cout << "  snapshot mmap  " << fixed << setprecision(4) << mapStartup << "s\n";
+    cout << "  mmap + warmer  " << fixed << setprecision(4) << firstLogin << "s to first login (no teardown), "
+         << setprecision(1) << warmingLogin * 1e6 << "us per login while warming, "
+         << setprecision(4) << warmSeconds << "s until all accounts are in memory\n";
+
+    remove(csvFile.c_str());
+    remove(snapshotFile.c_str());
+}
+
+// Compares a delta checkpoint after a few changes with a full snapshot
+void benchmarkCheckpoint(long long count, long long changes) {
+    string snapshotFile = "bench_accounts.dat";
+    BankSystem bank;
+    vector<BankAccount*> owners;
+    for (long long i = 0; i < count; i++) {
+        owners.push_back(bank.createAccount("Bench User", "1234", SAVINGS, Money::fromCents(10000)));
+    }
+    bank.checkpoint(snapshotFile);
+
+    for (long long i = 0; i < changes; i++) {
+        owners[(i * 7919) % count]->deposit(Money::fromCents(100));
+    }
+    auto start = chrono::steady_clock::now();
+    bank.checkpoint(snapshotFile);
+    double deltaSeconds = secondsSince(start);
+    long long deltaBytes = fileSize(snapshotFile + ".delta.1");
+
+    start = chrono::steady_clock::now();
+    bank.checkpoint(snapshotFile, true);
+    double fullSeconds = secondsSince(start);
+
+    cout << "accounts=" << count << " changed=" << changes << "\n";
+    cout << "  delta checkpoint " << fixed << setprecision(4) << deltaSeconds << "s  "
+         << deltaBytes << " bytes\n";
+    cout << "  full checkpoint  " << fixed << setprecision(4) << fullSeconds << "s  "
+         << fileSize(snapshotFile) << " bytes\n";
+    remove(snapshotFile.c_str());
+}
+
+// Measures a background full checkpoint and how much it slows deposits
+// made on the foreground thread while it runs
+void benchmarkBackgroundCheckpoint(long long count, long long ops) {
+    string snapshotFile = "bench_accounts.dat";
+    BankSystem bank;
+    vector<BankAccount*> owners;
+    for (long long i = 0; i < count; i++) {
+        owners.push_back(bank.createAccount("Bench User", "1234", SAVINGS, Money::fromCents(10000)));
+    }
+    bank.checkpoint(snapshotFile);
+
+    auto runDeposits = [&](double& maxMicros) {
+        maxMicros = 0;
+        auto start = chrono::steady_clock::now();
+        for (long long i = 0; i < ops; i++) {
+            auto opStart = chrono::steady_clock::now();
+            owners[(i * 7919) % count]->deposit(Money::fromCents(100));
+            maxMicros = max(maxMicros, chrono::duration<double, micro>(chrono::steady_clock::now() - opStart).count());
+        }
+        return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / ops;
+    };
+
+    double idleMax, busyMax;
+    double idleAvg = runDeposits(idleMax);
+    auto start = chrono::steady_clock::now();
+    bank.startCheckpoint(snapshotFile, true);
+    double blocked = secondsSince(start);
+    double busyAvg = runDeposits(busyMax);
+    bank.waitForCheckpoint();
+
+    cout << "accounts=" << count << " deposits=" << ops << "\n";
+    cout << "  startCheckpoint blocked the caller for " << fixed << setprecision(4) << blocked << "s\n";
+    bank.printCheckpointStats();
+    cout << "  deposit latency idle:   avg " << fixed << setprecision(2) << idleAvg
+         << "us, max " << idleMax << "us\n";
+    cout << "  deposit latency saving: avg " << fixed << setprecision(2) << busyAvg
+         << "us, max " << busyMax << "us\n";
+    remove(snapshotFile.c_str());
+}
+
+// Total size of the files making up a history store
+long long historyDiskUsage(string prefix, uint32_t segments) {
+    long long total = 0;
+    for (uint32_t number = 1; number <= segments; number++) {
+        total += max(0LL, fileSize(historyFileName(prefix, number, ".seg")));
+        total += max(0LL, fileSize(historyFileName(prefix, number, ".arc")));
+        total += max(0LL, fileSize(historyFileName(prefix, number, ".idx")));
+    }
+    return total;
+}
+
+// Builds `months` of synthetic history, then compares disk usage and
+// reopen (recovery) time before and after compaction
+void benchmarkCompaction(long long accounts, long long perAccountPerMonth, int months) {
+    string prefix = "bench_history";
+    time_t now = time(nullptr);
+    long long perMonth = accounts * perAccountPerMonth;
+    {
+        HistoryStore store;
+        store.open(prefix);
+        for (int month = months; month >= 0; month--) {
+            for (long long i = 0; i < perMonth; i++) {
+                Transaction t;
+                t.timestamp = now - month * 30LL * 24 * 60 * 60 - (perMonth - i);
+                t.kind = KIND_DEPOSIT;
+                t.counterparty = 0;
+                t.amount = Money::fromCents(1000);
+                t.balanceAfter = Money::fromCents(1000 * (months - month + 1) * perAccountPerMonth);
+                store.append(1001 + i % accounts, t);
+            }
+        }
+    }
+    uint32_t segments = 0;
+    while (fileSize(historyFileName(prefix, segments + 1, ".seg")) >= 0 ||
+           fileSize(historyFileName(prefix, segments + 1, ".idx")) >= 0) {
+        segments++;
+    }
+
+    auto timeOpen = [&] {
+        auto start = chrono::steady_clock::now();
+        HistoryStore store;
+        store.open(prefix);
+        return secondsSince(start);
+    };
+    long long before = historyDiskUsage(prefix, segments);
+    double openBefore = timeOpen();
+
+    CompactionStats stats;
+    auto start = chrono::steady_clock::now();
+    {
+        HistoryStore store;
+        store.open(prefix);
+        stats = store.compact(now - HISTORY_RETENTION_DAYS * 24 * 60 * 60, 0);
+    }
+    double compactSeconds = secondsSince(start);
+    long long after = historyDiskUsage(prefix, segments);
+    double openAfter = timeOpen();
+
+    cout << "accounts=" << accounts << " months=" << months << " records/account/month="
+         << perAccountPerMonth << "\n";
+    cout << "  before: " << before << " bytes, reopen " << fixed << setprecision(4) << openBefore << "s\n";
+    cout << "  after:  " << after << " bytes, reopen " << fixed << setprecision(4) << openAfter << "s\n";
+    cout << "  compacted " << stats.segmentsIn << " segments (" << stats.recordsIn << " records) into "
+         << stats.segmentsOut << " (" << stats.recordsOut << " records) in "
+         << fixed << setprecision(3) << compactSeconds << "s unthrottled\n";
+
+    for (uint32_t number = 1; number <= segments; number++) {
+        remove(historyFileName(prefix, number, ".seg").c_str());
+        remove(historyFileName(prefix, number, ".arc").c_str());
+        remove(historyFileName(prefix, number, ".idx").c_str());
+    }
+    remove((prefix + ".manifest").c_str());
+}
+
+// Compares the space one transaction takes in memory, as a raw history
+// record and in an archive block, then measures archive decode speed
+void benchmarkArchive(long long accounts, long long perAccount) {
+    // Transactions used to be a time_t, a type, two amounts and a
+    // std::string description, plus a heap block for any text too long
+    // for the string's inline buffer
+    const size_t stringRecordBytes = sizeof(time_t) * 2 + sizeof(double) * 2 + sizeof(string);
+    time_t now = time(nullptr);
+    map<uint64_t, vector<Transaction>> history;
+    uint64_t memoryBytes = 0, stringMemoryBytes = 0, rawBytes = 0;
+    for (long long a = 0; a < accounts; a++) {
+        string accNum = formatAccountNumber(1001 + a);
+        vector<Transaction>& rows = history[1001 + a];
+        Money balance;
+        for (long long i = 0; i < perAccount; i++) {
+            Transaction t;
+            int kind = (a * 31 + i * 7) % 10;
+            t.timestamp = now - (perAccount - i) * 3600 - a % 3600;
+            t.counterparty = 0;
+            if (kind == 9) {
+                t.kind = KIND_INTEREST;
+                t.amount = monthlyInterest(balance, SAVINGS);
+            } else if (kind >= 6 && balance > Money::fromCents(10000)) {
+                t.kind = kind == 8 ? KIND_TRANSFER_OUT : KIND_WITHDRAWAL;
+                t.counterparty = kind == 8 ? makeAccountId(FIRST_ACCOUNT_SEQUENCE + 1) : 0;
+                t.amount = Money::fromCents(-((a + i) % 100 + 1) * 100);
+            } else {
+                t.kind = KIND_DEPOSIT;
+                t.amount = Money::fromCents((a * 13 + i * 17) % 50000 + 100);
+            }
+            balance += t.amount;
+            t.balanceAfter = balance;
+            size_t textBytes = transactionText(t).size();
+            memoryBytes += sizeof(Transaction);
+            stringMemoryBytes += stringRecordBytes + (textBytes > 15 ? textBytes + 1 : 0);
+            rawBytes += sizeof(uint32_t) * 3 + accNum.size() + sizeof(int64_t) + sizeof(uint8_t) +
+                        sizeof(int64_t) * 2 + textBytes;
+            rows.push_back(t);
+        }
+    }
+
+    string archiveFile = "bench_history.arc";
+    vector<char> data;
+    auto start = chrono::steady_clock::now();
+    for (const auto& entry : history) {
+        vector<char> block = encodeArchiveBlock(entry.first, entry.second);
+        data.insert(data.end(), block.begin(), block.end());
+    }
+    double encodeSeconds = secondsSince(start);
+    writeFileDurably(archiveFile, data);
+
+    uint64_t rows = 0;
+    Money checksum;
+    start = chrono::steady_clock::now();
+    ArchiveReader reader(archiveFile);
+    uint64_t accountId;
+    vector<Transaction> block;
+    while (reader.next(accountId, block)) {
+        rows += block.size();
+        for (const Transaction& t : block) {
+            checksum += t.balanceAfter;
+        }
+    }
+    double decodeSeconds = secondsSince(start);
+
+    double total = double(accounts) * perAccount;
+    cout << "accounts=" << accounts << " transactions/account=" << perAccount << "\n";
+    cout << "  bytes/transaction: in memory " << fixed << setprecision(1) << memoryBytes / total
+         << " (" << stringMemoryBytes / total << " with string descriptions), raw record "
+         << rawBytes / total << ", archive " << data.size() / total << "\n";
+    cout << "  encode " << fixed << setprecision(0) << total / encodeSeconds << " rows/s, decode "
+         << rows / decodeSeconds << " rows/s (" << setprecision(1)
+         << rawBytes / decodeSeconds / 1e6 << " MB/s of raw records)"
+         << (rows == total && checksum != Money() ? "" : " MISMATCH") << "\n";
+    remove(archiveFile.c_str());
+}
+
+// Builds a synthetic history, exports it as a ledger, then compares a
+// full scan with a scan of the most recent tenth of the time range
+void benchmarkLedger(long long accounts, long long perAccount) {
+    string prefix = "bench_history";
+    string ledgerFile = "bench_ledger.col";
+    time_t now = time(nullptr);
+    long long total = accounts * perAccount;
+    {
+        HistoryStore store;
+        store.open(prefix);
+        for (long long i = 0; i < total; i++) {
+            Transaction t;
+            t.timestamp = now - (total - i) * 30;
+            t.kind = i % 5 == 0 ? KIND_WITHDRAWAL : KIND_DEPOSIT;
+            t.counterparty = 0;
+            t.amount = Money::fromCents(t.kind == KIND_WITHDRAWAL ? -(i % 200 + 1) * 100 : i % 50000 + 100);
+            t.balanceAfter = Money::fromCents(100000 + (i % 977) * 325);
+            store.append(1001 + i % accounts, t);
+        }
+    }
+    {
+        HistoryStore store;
+        store.open(prefix);
+        auto start = chrono::steady_clock::now();
+        LedgerWriter writer;
+        writer.open(ledgerFile);
+        uint64_t historyBytes = store.forEachTransaction([&writer](uint64_t accountId, const Transaction& t) {
+            writer.add(formatAccountNumber(accountId), t);
+        });
+        writer.close();
+        double exportSeconds = secondsSince(start);
+        cout << "rows=" << total << " row groups=" << writer.rowGroups() << "\n";
+        cout << "  export " << fixed << setprecision(3) << exportSeconds << "s, "
+             << setprecision(1) << double(writer.bytesWritten()) / total << " bytes/row (history "
+             << double(historyBytes) / total << " bytes/row)\n";
+    }
+
+    LedgerReader reader;
+    reader.open(ledgerFile);
+    for (bool recent : {false, true}) {
+        time_t from = recent ? now - total * 30 / 10 : 0;
+        auto start = chrono::steady_clock::now();
+        LedgerScanStats stats = reader.scan(from, now, Money::fromCents(INT64_MIN), Money::fromCents(INT64_MAX),
+                                            [](const string&, const Transaction&) {});
+        double seconds = secondsSince(start);
+        cout << "  " << (recent ? "last 10% scan " : "full scan     ") << fixed << setprecision(4) << seconds
+             << "s, " << stats.rowsMatched << " rows, " << stats.groupsRead << " groups read, "
+             << stats.groupsSkipped << " skipped, " << setprecision(0) << stats.rowsMatched / seconds
+             << " rows/s\n";
+    }
+
+    // Sealed segments have an index; the last one is the active segment
+    for (uint32_t number = 1; ; number++) {
+        bool sealed = remove(historyFileName(prefix, number, ".idx").c_str()) == 0;
+        remove(historyFileName(prefix, number, ".arc").c_str());
+        remove(historyFileName(prefix, number, ".seg").c_str());
+        if (!sealed) {
+            break;
+        }
+    }
+    remove(ledgerFile.c_str());
+}
+
+// Records deposits against accounts backed by a history store, then sets
+// the memory their rings and journal entries take beside the per-account
+// vectors they replaced (trimmed to 32 entries whenever they reached 64),
+// and times statements served from the ring, walked from the journal and
+// read from the store
+void benchmarkStatement(long long accounts, long long perAccount) {
+    string prefix = "bench_statement";
+    {
+        HistoryStore store;
+        store.open(prefix);
+        AccountArena arena;
+        vector<BankAccount*> list;
+        for (long long i = 0; i < accounts; i++) {
+            list.push_back(arena.create(makeAccountId(FIRST_ACCOUNT_SEQUENCE + i), "Alice Smith", "1234", SAVINGS));
+            list.back()->setHistory(&store);
+        }
+
+        vector<vector<Transaction>> vectors(accounts);
+        TransactionJournal journal;
+        for (BankAccount* account : list) {
+            account->setJournal(&journal);
+        }
+        auto start = chrono::steady_clock::now();
+        for (long long n = 0; n < perAccount; n++) {
+            for (long long i = 0; i < accounts; i++) {
+                list[i]->deposit(Money::fromCents(n % 5000 + 100));
+            }
+        }
+        double recordSeconds = secondsSince(start);
+        size_t journalBytes = journal.memoryBytes();
+        uint64_t ringBytes = accounts * (sizeof(unique_ptr<TransactionRing>) +
+                                         (perAccount > 0 ? sizeof(TransactionRing) : 0));
+        for (long long n = 0; n < perAccount; n++) {
+            for (vector<Transaction>& history : vectors) {
+                history.push_back(Transaction());
+                if (history.size() >= 64) {
+                    history.erase(history.begin(), history.end() - 32);
+                }
+            }
+        }
+        uint64_t vectorBytes = 0;
+        for (const vector<Transaction>& history : vectors) {
+            vectorBytes += sizeof(history) + history.capacity() * sizeof(Transaction);
+        }
+
+        ostringstream sink;
+        streambuf* console = cout.rdbuf(sink.rdbuf());
+        start = chrono::steady_clock::now();
+        for (BankAccount* account : list) {
+            account->printStatement(5);
+            sink.str("");
+        }
+        double ringSeconds = secondsSince(start);
+        start = chrono::steady_clock::now();
+        for (BankAccount* account : list) {
+            account->printStatement(20);
+            sink.str("");
+        }
+        double journalSeconds = secondsSince(start);
+        cout.rdbuf(console);
+        long long storeReads = min<long long>(accounts, 1000);
+        size_t found = 0;
+        start = chrono::steady_clock::now();
+        for (long long i = 0; i < storeReads; i++) {
+            found += store.recent(list[i]->getId(), 20).size();
+        }
+        double storeSeconds = secondsSince(start);
+
+        double total = double(accounts) * perAccount;
+        cout << "accounts=" << accounts << " transactions/account=" << perAccount << "\n";
+        cout << "  recorded " << fixed << setprecision(0) << total / recordSeconds << " transactions/s\n";
+        cout << "  memory/account: ring " << setprecision(1) << double(ringBytes) / accounts
+             << " bytes (fixed) + chain head " << sizeof(atomic<uint64_t>) << " bytes + journal "
+             << journalBytes / total << " bytes/transaction (" << journalBytes / double(accounts)
+             << " here), trimmed vector " << double(vectorBytes) / accounts << " bytes\n";
+        cout << "  statement of 5 from the ring " << setprecision(2) << ringSeconds / accounts * 1e6
+             << "us printed; of 20 from the journal " << journalSeconds / accounts * 1e6
+             << "us printed, from the store " << storeSeconds / storeReads * 1e6 << "us read only"
+             << (found == size_t(storeReads) * min<long long>(perAccount, 20) ? "" : " MISMATCH") << "\n";
+    }
+    for (uint32_t number = 1; ; number++) {
+        bool sealed = remove(historyFileName(prefix, number, ".idx").c_str()) == 0;
+        remove(historyFileName(prefix, number, ".arc").c_str());
+        remove(historyFileName(prefix, number, ".seg").c_str());
+        if (!sealed) {
+            break;
+        }
+    }
+}
+
+// Appends from several threads at once, each to its own accounts plus
+// one account they all share, into a journal and into per-account
+// vectors behind one mutex. Then checks that every chain holds its
+// account's entries: for an account with one writer, in the order the
+// global stream has them; for the shared one, in each writer's order.
+// Last, the same appends go into a ring that holds a sixteenth of them,
+// which must keep the newest entries of each chain in a fixed footprint.
+void benchmarkJournal(int threadCount, long long perThread) {
+    const long long accountsPerThread = 1000;
+    long long accounts = threadCount * accountsPerThread + 1;
+    long long total = threadCount * perThread;
+    auto run = [threadCount](function<void(int)> work) {
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.emplace_back(work, t);
+        }
+        for (thread& worker : threads) {
+            worker.join();
+        }
+        return secondsSince(start);
+    };
+    auto transaction = [](long long i) {
+        Transaction t = {};
+        t.timestamp = i;
+        t.kind = KIND_DEPOSIT;
+        t.amount = Money::fromCents(i % 5000 + 100);
+        return t;
+    };
 
-// Bank Account
-class BankAccount {
-private:
-    string accountNumber;
-    string holderName;
-    string pin;
-    double balance;
-    AccountType type;
-    vector<Transaction> transactions;
+    auto appendAll = [&](TransactionJournal& ledger, atomic<uint64_t>* heads, long long first) {
+        return run([&](int t) {
+            for (long long i = 0; i < perThread; i++) {
+                // Every eighth append goes to the shared account, the last one
+                long long account = i % 8 == 0 ? accounts - 1 : t * accountsPerThread + i % accountsPerThread;
+                ledger.append(account, transaction(first + t * perThread + i), heads[account]);
+            }
+        });
+    };
 
-public:
-    BankAccount(string num, string name, string pin, AccountType type, double initial = 0.0)
-        : accountNumber(num), holderName(name), pin(pin), type(type), balance(initial) {}
+    TransactionJournal ledger;
+    unique_ptr<atomic<uint64_t>[]> heads(new atomic<uint64_t>[accounts]());
+    double journalSeconds = appendAll(ledger, heads.get(), 0);
 
-    string getAccountNumber() const { return accountNumber; }
-    string getHolderName() const { return holderName; }
-    double getBalance() const { return balance; }
-    AccountType getAccountType() const { return type; }
+    mutex lock;
+    vector<vector<Transaction>> vectors(accounts);
+    double mutexSeconds = run([&](int t) {
+        for (long long i = 0; i < perThread; i++) {
+            long long account = i % 8 == 0 ? accounts - 1 : t * accountsPerThread + i % accountsPerThread;
+            lock_guard<mutex> guard(lock);
+            vectors[account].push_back(transaction(t * perThread + i));
+        }
+    });
 
-    bool verifyPin(string inputPin) const {
-        return pin == inputPin;
+    // Walking each chain newest first must give the account's entries of
+    // the global stream in reverse
+    vector<vector<int64_t>> streamed(accounts);
+    uint64_t streamedCount = 0;
+    auto start = chrono::steady_clock::now();
+    ledger.forEach([&](uint64_t account, const Transaction& t) {
+        streamed[account].push_back(t.timestamp);
+        streamedCount++;
+    });
+    double streamSeconds = secondsSince(start);
+    bool consistent = streamedCount == uint64_t(total);
+    start = chrono::steady_clock::now();
+    for (long long account = 0; account < accounts - 1 && consistent; account++) {
+        size_t position = streamed[account].size();
+        ledger.forEachInChain(heads[account].load(), SIZE_MAX, [&](const Transaction& t) {
+            consistent = consistent && position > 0 && streamed[account][--position] == t.timestamp;
+        });
+        consistent = consistent && position == 0;
     }
+    vector<int64_t> newest(threadCount, numeric_limits<int64_t>::max());
+    size_t shared = 0;
+    ledger.forEachInChain(heads[accounts - 1].load(), SIZE_MAX, [&](const Transaction& t) {
+        int64_t& writer = newest[t.timestamp / perThread];
+        consistent = consistent && t.timestamp < writer;
+        writer = t.timestamp;
+        shared++;
+    });
+    consistent = consistent && shared == streamed[accounts - 1].size();
+    double chainSeconds = secondsSince(start);
 
-    void changePin(string newPin) {
-        pin = newPin;
-        recordTransaction("PIN Changed", 0, balance);
+    // Retire all but about the newest sixteenth, as a checkpoint does once
+    // the history store holds them, while a second round of appends runs:
+    // the stream must then start at firstKept() and every chain must be a
+    // run of the newest entries of its account
+    size_t fullBytes = ledger.memoryBytes();
+    uint64_t retireThrough = ledger.size() - ledger.size() / 16;
+    thread retirer([&] { ledger.retire(retireThrough); });
+    double secondSeconds = appendAll(ledger, heads.get(), total);
+    retirer.join();
+    size_t retiredBytes = ledger.memoryBytes();
+    uint64_t kept = 0, streamedAfter = 0;
+    vector<int64_t> latest(threadCount, -1);
+    ledger.forEach([&](uint64_t, const Transaction& t) {
+        int64_t& writer = latest[t.timestamp % total / perThread];
+        consistent = consistent && t.timestamp > writer;
+        writer = t.timestamp;
+        streamedAfter++;
+    });
+    consistent = consistent && streamedAfter == ledger.size() - ledger.firstKept() + 1;
+    for (long long account = 0; account < accounts - 1 && consistent; account++) {
+        int64_t newer = numeric_limits<int64_t>::max();
+        ledger.forEachInChain(heads[account].load(), SIZE_MAX, [&](const Transaction& t) {
+            consistent = consistent && t.timestamp < newer;
+            newer = t.timestamp;
+            kept++;
+        });
     }
 
-    void deposit(double amount, string description = "Deposit") {
-        if (amount <= 0) {
-            throw invalid_argument("Amount must be positive");
+    cout << "threads=" << threadCount << " appends/thread=" << perThread << "\n";
+    cout << "  lock-free journal " << fixed << setprecision(1) << total / journalSeconds / 1e6
+         << "M appends/s, mutex + vectors " << total / mutexSeconds / 1e6 << "M appends/s\n";
+    cout << "  global stream " << total / streamSeconds / 1e6 << "M entries/s, per-account chains "
+         << total / chainSeconds / 1e6 << "M entries/s" << (consistent ? "" : "  (MISMATCH)") << "\n";
+    cout << "  appending while retiring: " << total / secondSeconds / 1e6 << "M appends/s; "
+         << ledger.firstKept() - 1 << " retired, " << kept << " kept in chains, "
+         << retiredBytes / (1 << 20) << " MiB after the second round (" << fullBytes / (1 << 20)
+         << " MiB after the first)\n";
+}
+
+// CRC-32C throughput over a buffer: table-driven, hardware, and the
+// parallel block verification used when loading snapshots
+void benchmarkChecksum(long long megabytes) {
+    vector<char> data(size_t(megabytes) << 20);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = char(i * 2654435761u >> 13);
+    }
+    auto measure = [&](const string& label, function<uint32_t()> run) {
+        run(); // warm up caches and page mappings
+        const int rounds = 5;
+        uint32_t result = 0;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < rounds; i++) {
+            result ^= run();
         }
-        balance += amount;
-        recordTransaction(description, amount, balance);
+        double seconds = secondsSince(start) / rounds;
+        cout << "  " << setw(26) << left << label << right << fixed << setprecision(2)
+             << data.size() / seconds / 1e9 << " GB/s\n";
+        static volatile uint32_t sink;
+        sink = result; // keep the work from being optimized away
+        (void)sink;
+    };
+
+    cout << "buffer=" << megabytes << " MiB, cores=" << thread::hardware_concurrency() << "\n";
+    measure("software (slicing-by-8)", [&] { return crc32cSoftware(0, data.data(), data.size()); });
+#ifdef CRC32C_HARDWARE
+    if (crc32cHasHardware()) {
+        measure("hardware (SSE4.2)", [&] { return crc32cHardware(0, data.data(), data.size()); });
+    } else {
+        cout << "  hardware CRC-32C not supported by this CPU\n";
     }
+#endif
+    measure("parallel 1 MiB blocks", [&] {
+        return crc32cBlocks(data.data(), data.size(), SNAPSHOT_CHECKSUM_BLOCK).back();
+    });
+}
 
-    bool withdraw(double amount, string description = "Withdrawal") {
-        if (amount <= 0) {
-            throw invalid_argument("Amount must be positive");
+// Compares account creation, a bank-wide pass (monthly interest) and
+// teardown with accounts from the slab arena against one new/delete per
+// account, as BankSystem allocated them before
+void benchmarkArena(long long count) {
+    const char* names[] = {"Alice Smith", "Bob Jones", "Carol White", "Dan Brown", "Eve Black"};
+    auto report = [](const string& label, double create, double interest, double teardown) {
+        cout << "  " << setw(18) << left << label << right << fixed << setprecision(3)
+             << "create " << create << "s  interest " << interest << "s  teardown " << teardown << "s\n";
+    };
+    cout << "accounts=" << count << "\n";
+
+    {
+        auto start = chrono::steady_clock::now();
+        vector<BankAccount*> list;
+        list.reserve(count);
+        vector<int64_t> balances(count);
+        vector<uint8_t> types(count);
+        for (long long i = 0; i < count; i++) {
+            list.push_back(new BankAccount(AccountHotFields{&balances[i], &types[i]},
+                                           makeAccountId(FIRST_ACCOUNT_SEQUENCE + i), names[i % 5], "1234",
+                                           i % 3 == 0 ? CURRENT : SAVINGS, Money::fromCents((i % 100000) * 125)));
         }
-        if (balance >= amount) {
-            balance -= amount;
-            recordTransaction(description, -amount, balance);
-            return true;
+        double create = secondsSince(start);
+        start = chrono::steady_clock::now();
+        for (BankAccount* account : list) {
+            account->addInterest();
         }
-        return false;
+        double interest = secondsSince(start);
+        start = chrono::steady_clock::now();
+        for (BankAccount* account : list) {
+            delete account;
+        }
+        list.clear();
+        report("new/delete", create, interest, secondsSince(start));
     }
 
-    void addInterest() {
-        double interest = 0;
-        if (type == SAVINGS) {
-            interest = balance * SAVINGS_INTEREST_RATE / 12; // Monthly interest
-        } else {
-            interest = balance * CURRENT_INTEREST_RATE / 12;
+    for (bool hugePages : {false, true}) {
+        auto start = chrono::steady_clock::now();
+        unique_ptr<AccountArena> arena(new AccountArena(hugePages));
+        for (long long i = 0; i < count; i++) {
+            arena->create(makeAccountId(FIRST_ACCOUNT_SEQUENCE + i), names[i % 5], "1234",
+                          i % 3 == 0 ? CURRENT : SAVINGS, Money::fromCents((i % 100000) * 125));
         }
-        balance += interest;
-        recordTransaction("Interest Credited", interest, balance);
+        double create = secondsSince(start);
+        start = chrono::steady_clock::now();
+        arena->forEach([](BankAccount* account) { account->addInterest(); });
+        double interest = secondsSince(start);
+        start = chrono::steady_clock::now();
+        arena.reset();
+        report(hugePages ? "arena, huge pages" : "arena", create, interest, secondsSince(start));
     }
+}
 
-    void recordTransaction(string desc, double amount, double newBalance) {
-        Transaction t;
-        t.timestamp = time(nullptr);
-        t.amount = amount;
-        t.description = desc;
-        t.balanceAfter = newBalance;
-        
-        if (amount > 0) {
-            t.type = DEPOSIT;
-        } else if (amount < 0) {
-            t.type = WITHDRAWAL;
-        } else {
-            t.type = TRANSFER;
+// Compares bank-wide sweeps that walk account objects with the same
+// sweeps over the arena's hot arrays: summing balances, and posting a
+// month's interest. The hot-array sum adds integer cents; it is checked
+// against the object walk and set beside a sum of the same balances held
+// as doubles, which is how they were stored before. BankTotals also
+// counts accounts by type, so it is timed separately.
+void benchmarkSweep(long long count) {
+    const char* names[] = {"Alice Smith", "Bob Jones", "Carol White", "Dan Brown", "Eve Black"};
+    AccountArena objectArena, hotArena;
+    vector<double> doubles;
+    doubles.reserve(count);
+    for (long long i = 0; i < count; i++) {
+        // Odd cents so the doubles are not exact binary fractions
+        Money balance = Money::fromCents((i % 100000) * 125 + i % 97);
+        for (AccountArena* arena : {&objectArena, &hotArena}) {
+            arena->create(makeAccountId(FIRST_ACCOUNT_SEQUENCE + i), names[i % 5], "1234",
+                          i % 3 == 0 ? CURRENT : SAVINGS, balance);
         }
-        
-        transactions.push_back(t);
+        doubles.push_back(balance.toDouble());
     }
+    cout << "accounts=" << count << " (" << sizeof(BankAccount) << "-byte objects, "
+         << sizeof(int64_t) + 2 * sizeof(uint8_t) << " hot bytes each)\n";
 
-    void printStatement(int count = 5) const {
-        cout << "\nAccount Statement for " << holderName << " (" << accountNumber << ")\n";
-        cout << "Current Balance: $" << fixed << setprecision(2) << balance << "\n\n";
-        cout << "Last " << count << " transactions:\n";
-        cout << "--------------------------------------------------\n";
-        cout << "Date/Time           | Type      | Amount   | Balance\n";
-        cout << "--------------------------------------------------\n";
+    const int rounds = 5;
+    Money sum;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        sum = Money();
+        objectArena.forEach([&sum](BankAccount* account) { sum += account->getBalance(); });
+    }
+    double objectSum = secondsSince(start) / rounds;
+    start = chrono::steady_clock::now();
+    Money hotTotal;
+    for (int r = 0; r < rounds; r++) {
+        hotTotal = Money();
+        hotArena.forEachSlab([&hotTotal](const AccountArena::SlabView& slab) {
+            hotTotal += sumBalances(slab.balances, slab.slots);
+        });
+    }
+    double hotSum = secondsSince(start) / rounds;
+    start = chrono::steady_clock::now();
+    BankTotals totals;
+    for (int r = 0; r < rounds; r++) {
+        totals = sumAccounts(hotArena);
+    }
+    double totalsTime = secondsSince(start) / rounds;
+    start = chrono::steady_clock::now();
+    double doubleTotal = 0;
+    for (int r = 0; r < rounds; r++) {
+        doubleTotal = 0;
+        for (double balance : doubles) {
+            doubleTotal += balance;
+        }
+    }
+    double doubleSum = secondsSince(start) / rounds;
 
-        int start = transactions.size() > count ? transactions.size() - count : 0;
-        for (size_t i = start; i < transactions.size(); i++) {
-            const Transaction& t = transactions[i];
-            cout << put_time(localtime(&t.timestamp), "%Y-%m-%d %H:%M:%S") << " | ";
-            
-            switch (t.type) {
-                case DEPOSIT: cout << "Deposit   "; break;
-                case WITHDRAWAL: cout << "Withdrawal"; break;
-                case TRANSFER: cout << "Transfer  "; break;
-            }
-            
-            cout << " | $" << setw(8) << fixed << setprecision(2) << abs(t.amount) 
-                 << " | $" << setw(8) << fixed << setprecision(2) << t.balanceAfter << endl;
+    start = chrono::steady_clock::now();
+    objectArena.forEach([](BankAccount* account) { account->addInterest(); });
+    double objectInterest = secondsSince(start);
+    start = chrono::steady_clock::now();
+    postMonthlyInterest(hotArena);
+    double hotInterest = secondsSince(start);
+
+    auto rate = [count](double seconds) { return count / seconds / 1e6; };
+    cout << fixed << setprecision(2)
+         << "  sum balances  objects " << objectSum * 1e3 << "ms (" << rate(objectSum) << "M/s)  hot arrays "
+         << hotSum * 1e3 << "ms (" << rate(hotSum) << "M/s)"
+         << (sum == hotTotal && sum == totals.balance ? "" : "  (MISMATCH)") << "\n"
+         << "  double sum    " << doubleSum * 1e3 << "ms (" << rate(doubleSum) << "M/s), off the exact total $"
+         << sum << " by $" << setprecision(6) << fabs(doubleTotal - sum.toDouble()) << setprecision(2) << "\n"
+         << "  BankTotals    " << totalsTime * 1e3 << "ms (" << rate(totalsTime) << "M/s)\n"
+         << "  interest      objects " << objectInterest * 1e3 << "ms  hot arrays " << hotInterest * 1e3 << "ms"
+         << (sumAccounts(objectArena).balance == sumAccounts(hotArena).balance ? "" : "  (MISMATCH)") << "\n";
+}
+
+// Measures holder-name storage on a synthetic bank whose names repeat the
+// way real ones do: a few thousand first/last combinations, the common
+// ones far more often. Sets a std::string per account beside a handle per
+// account plus the intern pool, and the name bytes the version 6 snapshot
+// saves by writing each distinct name once.
+void benchmarkIntern(long long count) {
+    const char* firsts[] = {"James", "Mary", "Robert", "Patricia", "John", "Jennifer", "Michael", "Linda",
+                            "David", "Elizabeth", "William", "Barbara", "Richard", "Susan", "Joseph", "Jessica",
+                            "Thomas", "Sarah", "Christopher", "Karen", "Priya", "Rahul", "Anjali", "Venkatesh",
+                            "Mohammed", "Fatima", "Wei", "Mei", "Alexander", "Margaret"};
+    const char* lasts[] = {"Smith", "Johnson", "Williams", "Brown", "Jones", "Garcia", "Miller", "Davis",
+                           "Rodriguez", "Martinez", "Hernandez", "Lopez", "Gonzalez", "Wilson", "Anderson",
+                           "Thomas", "Taylor", "Moore", "Jackson", "Martin", "Kumar", "Sharma", "Subramanian",
+                           "Venkataraman", "Chen", "Wang", "Nguyen", "Okonkwo", "Fitzgerald", "Abernathy",
+                           "Christodoulou", "Lee", "Khan", "Singh", "Patel", "Ivanova", "Kowalski", "Santos",
+                           "Rossi", "Muller"};
+    const size_t firstCount = sizeof(firsts) / sizeof(firsts[0]);
+    const size_t lastCount = sizeof(lasts) / sizeof(lasts[0]);
+    string snapshotFile = "bench_intern.dat";
+
+    size_t poolBefore = holderNames().size();
+    uint64_t stringBytes = 0, textBytes = 0;
+    auto start = chrono::steady_clock::now();
+    {
+        BankSystem bank;
+        uint64_t state = 42;
+        auto draw = [&state](size_t n) {
+            // Squaring a uniform draw favours the front of each list
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            double u = (state >> 11) * 0x1.0p-53;
+            return static_cast<size_t>(u * u * n);
+        };
+        for (long long i = 0; i < count; i++) {
+            size_t first = draw(firstCount);
+            string name = string(firsts[first]) + " " + lasts[draw(lastCount)];
+            stringBytes += sizeof(string) + (name.size() > 15 ? name.size() + 1 : 0);
+            textBytes += sizeof(uint32_t) + name.size();
+            bank.createAccount(name, "1234", i % 3 == 0 ? CURRENT : SAVINGS, Money::fromCents((i % 100000) * 125));
         }
-        cout << "--------------------------------------------------\n";
+        cout << "accounts=" << count << " (" << holderNames().size() - poolBefore << " distinct names, built in "
+             << fixed << setprecision(3) << secondsSince(start) << "s)\n";
+        bank.saveToFile(snapshotFile);
     }
-};
 
-// Bank Management System
-class BankSystem {
-private:
-    map<string, BankAccount*> accounts;
-    string adminPassword = "admin123";
+    start = chrono::steady_clock::now();
+    {
+        BankSystem bank;
+        bank.loadFromFile(snapshotFile);
+    }
+    double load = secondsSince(start);
 
-    string generateAccountNumber() {
-        static int lastNumber = 1000;
-        return "ACCT" + to_string(++lastNumber);
+    // The snapshot's name run holds each name this bank added to the pool
+    uint64_t pooledBytes = 0;
+    for (size_t handle = poolBefore; handle < holderNames().size(); handle++) {
+        pooledBytes += sizeof(uint32_t) + holderNames().get(handle).size();
     }
 
-    bool isAdmin(string password) {
-        return password == adminPassword;
+    uint64_t handleBytes = count * sizeof(InternPool::Handle) + holderNames().memoryBytes();
+    cout << fixed << setprecision(1)
+         << "  in memory  std::string " << stringBytes / 1048576.0 << " MiB (" << double(stringBytes) / count
+         << " B/account)  handles + pool " << handleBytes / 1048576.0 << " MiB (" << double(handleBytes) / count
+         << " B/account)  BankAccount is " << sizeof(BankAccount) << " bytes\n"
+         << "  snapshot   " << fileSize(snapshotFile) << " bytes, names " << pooledBytes << " bytes instead of "
+         << textBytes << ", load " << setprecision(3) << load << "s\n";
+    remove(snapshotFile.c_str());
+}
+
+// Compares account lookups through the flat AccountIndex against the
+// std::map keyed by account number string that it replaced. Both hold
+// placeholder pointers so large banks fit in memory; the map is skipped
+// when its nodes would not fit in half of physical memory.
+void benchmarkLookup(long long count) {
+    const long long queries = 1000000;
+    vector<string> keys;
+    keys.reserve(queries);
+    uint64_t state = 42;
+    for (long long i = 0; i < queries; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        keys.push_back("ACCT" + to_string(1001 + (state >> 24) % count));
     }
+    auto placeholder = [](long long i) { return reinterpret_cast<BankAccount*>(uintptr_t(i + 1) * 16); };
+    auto report = [&](const string& label, double buildSeconds, double lookupSeconds, uint64_t bytes) {
+        cout << "  " << setw(14) << left << label << right << fixed << setprecision(3)
+             << buildSeconds << "s build, " << setprecision(1) << lookupSeconds / queries * 1e9
+             << " ns/lookup, ~" << bytes / (1024 * 1024) << " MiB\n";
+    };
+    static volatile uintptr_t sink;
+    cout << "accounts=" << count << " lookups=" << queries << "\n";
 
-public:
-    ~BankSystem() {
-        for (auto& pair : accounts) {
-            delete pair.second;
+    {
+        auto start = chrono::steady_clock::now();
+        AccountIndex index;
+        index.reserve(count);
+        for (long long i = 0; i < count; i++) {
+            index.put(1001 + i, placeholder(i));
+        }
+        double build = secondsSince(start);
+        start = chrono::steady_clock::now();
+        uintptr_t found = 0;
+        for (const string& key : keys) {
+            uint64_t id;
+            if (parseAccountNumber(key, id)) {
+                found += reinterpret_cast<uintptr_t>(index.find(id));
+            }
+        }
+        double lookup = secondsSince(start);
+        sink = found;
+        uint64_t capacity = 16;
+        while (capacity * 3 < uint64_t(count) * 4) {
+            capacity *= 2;
         }
+        report("flat index", build, lookup, capacity * sizeof(AccountIndex::Slot));
     }
 
-    BankAccount* createAccount(string name, string pin, AccountType type, double initialDeposit = 0.0) {
-        string accNum = generateAccountNumber();
-        BankAccount* account = new BankAccount(accNum, name, pin, type, initialDeposit);
-        accounts[accNum] = account;
-        return account;
+    const uint64_t mapNodeBytes = 80; // tree links + SSO string + value, after malloc rounding
+    uint64_t mapBytes = uint64_t(count) * mapNodeBytes;
+#ifndef _WIN32
+    uint64_t physical = uint64_t(sysconf(_SC_PHYS_PAGES)) * uint64_t(sysconf(_SC_PAGE_SIZE));
+    if (mapBytes > physical / 2) {
+        cout << "  " << setw(14) << left << "std::map" << right << "skipped, needs ~"
+             << mapBytes / (1024 * 1024) << " MiB\n";
+        return;
     }
-
-    BankAccount* login(string accountNumber, string pin, int& attemptsLeft) {
-        auto it = accounts.find(accountNumber);
-        if (it != accounts.end()) {
-            if (it->second->verifyPin(pin)) {
-                attemptsLeft = MAX_LOGIN_ATTEMPTS;
-                return it->second;
-            } else {
-                attemptsLeft--;
-                if (attemptsLeft <= 0) {
-                    cout << "Too many failed attempts. Account temporarily locked.\n";
-                }
-                return nullptr;
+#endif
+    {
+        auto start = chrono::steady_clock::now();
+        map<string, BankAccount*> byNumber;
+        for (long long i = 0; i < count; i++) {
+            byNumber.emplace("ACCT" + to_string(1001 + i), placeholder(i));
+        }
+        double build = secondsSince(start);
+        start = chrono::steady_clock::now();
+        uintptr_t found = 0;
+        for (const string& key : keys) {
+            auto it = byNumber.find(key);
+            if (it != byNumber.end()) {
+                found += reinterpret_cast<uintptr_t>(it->second);
             }
         }
-        return nullptr;
+        double lookup = secondsSince(start);
+        sink = found;
+        report("std::map", build, lookup, mapBytes);
     }
+    (void)sink;
+}
 
-    bool transfer(BankAccount* from, string toAccountNumber, double amount) {
-        auto it = accounts.find(toAccountNumber);
-        if (it != accounts.end() && from->withdraw(amount, "Transfer to " + toAccountNumber)) {
-            it->second->deposit(amount, "Transfer from " + from->getAccountNumber());
-            return true;
+// Measures transaction log throughput with concurrent depositors, once with
+// an fsync per record and once with group commit
+void benchmarkGroupCommit(int threadCount, int opsPerThread) {
+    for (size_t maxBatch : {size_t(1), LOG_MAX_BATCH_RECORDS}) {
+        string logFile = "bench_accounts.wal";
+        remove(logFile.c_str());
+        {
+            BankSystem bank;
+            bank.openLog(logFile);
+            bank.configureLog(maxBatch, chrono::microseconds(LOG_MAX_BATCH_WAIT_MICROS));
+
+            vector<BankAccount*> owners;
+            for (int i = 0; i < threadCount; i++) {
+                owners.push_back(bank.createAccount("Bench User", "1234", SAVINGS));
+            }
+
+            auto start = chrono::steady_clock::now();
+            vector<thread> workers;
+            for (BankAccount* account : owners) {
+                workers.emplace_back([account, opsPerThread] {
+                    for (int i = 0; i < opsPerThread; i++) {
+                        account->deposit(Money::fromCents(100));
+                    }
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            double elapsed = secondsSince(start);
+
+            cout << "threads=" << threadCount << " maxBatch=" << maxBatch << "\n";
+            cout << "  " << fixed << setprecision(0)
+                 << (threadCount * double(opsPerThread)) / elapsed << " deposits/sec\n";
+            bank.printLogStats();
         }
+        remove(logFile.c_str());
+    }
+}
+
+// Flushes a file and asks the OS to drop it from the page cache, so the
+// next read comes from disk. Returns false where that is not supported.
+bool dropFromPageCache(const string& filename) {
+#if defined(_WIN32) || !defined(POSIX_FADV_DONTNEED)
+    (void)filename;
+    return false;
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
         return false;
     }
+    bool ok = fsync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    ::close(fd);
+    return ok;
+#endif
+}
 
-    void applyMonthlyInterest() {
-        for (auto& pair : accounts) {
-            pair.second->addInterest();
+// Every file a bank recovers from: snapshot, deltas, logs and history
+vector<string> recoveryFiles(const string& snapshotFile, const string& historyPrefix, const string& logFile) {
+    vector<string> files = {snapshotFile, logFile, TransactionLog::rotatedName(logFile), historyPrefix + ".manifest"};
+    for (uint32_t number = 1; fileSize(snapshotFile + ".delta." + to_string(number)) >= 0; number++) {
+        files.push_back(snapshotFile + ".delta." + to_string(number));
+    }
+    for (uint32_t number = 1; ; number++) {
+        bool sealed = fileSize(historyFileName(historyPrefix, number, ".idx")) >= 0;
+        for (string extension : {".seg", ".arc", ".idx"}) {
+            files.push_back(historyFileName(historyPrefix, number, extension));
+        }
+        if (!sealed) {
+            break;
         }
-        cout << "Monthly interest applied to all accounts.\n";
     }
+    return files;
+}
 
-    void printAllAccounts(string adminPassword) {
-        if (!isAdmin(adminPassword)) {
-            cout << "Unauthorized access!\n";
-            return;
+// Bytes this process has read: through read calls, and from storage.
+// Either is -1 where the OS does not report it.
+void processBytesRead(long long& syscallBytes, long long& storageBytes) {
+    syscallBytes = storageBytes = -1;
+    ifstream io("/proc/self/io");
+    string key;
+    long long value;
+    while (io >> key >> value) {
+        if (key == "rchar:") {
+            syscallBytes = value;
+        } else if (key == "read_bytes:") {
+            storageBytes = value;
         }
+    }
+}
 
-        cout << "\nAll Accounts Summary\n";
-        cout << "--------------------------------------------------\n";
-        cout << "Account Number | Holder Name       | Type     | Balance\n";
-        cout << "--------------------------------------------------\n";
+// Peak resident set size of this process in KiB, or -1 if unknown
+long long peakRssKiB() {
+#ifdef _WIN32
+    return -1;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
 
-        for (const auto& pair : accounts) {
-            cout << pair.first << " | " << setw(17) << left << pair.second->getHolderName() << " | ";
-            cout << (pair.second->getAccountType() == SAVINGS ? "Savings " : "Current ") << " | $";
-            cout << fixed << setprecision(2) << pair.second->getBalance() << endl;
-        }
-        cout << "--------------------------------------------------\n";
+string jsonNumber(long long value) {
+    return value < 0 ? "null" : to_string(value);
+}
+
+// Runs one recovery the way main() does: snapshot (loaded or mapped),
+// history, log replay, then the first login. Prints a JSON object with
+// the time taken, peak RSS and bytes read. Started in a child process by
+// benchmarkRecovery so each measurement has a fresh heap and counters.
+//   --recovery-probe <load|map> <snapshot> <history prefix> <log>
+int recoveryProbe(int argc, char* argv[]) {
+    if (argc != 4) {
+        cerr << "Usage: --recovery-probe <load|map> <snapshot> <history prefix> <log>\n";
+        return 2;
     }
+    string mode = argv[0];
+    auto start = chrono::steady_clock::now();
+    BankSystem bank;
+    bool loaded = mode == "map" ? bank.mapFromFile(argv[1]) : bank.loadFromFile(argv[1]);
+    bank.openHistory(argv[2]);
+    bank.openLog(argv[3]);
+    int attempts = MAX_LOGIN_ATTEMPTS;
+    bool loggedIn = bank.login(makeAccountId(FIRST_ACCOUNT_SEQUENCE), "1234", attempts) != nullptr;
+    double seconds = secondsSince(start);
 
-    void saveToFile(string filename) {
-        ofstream file(filename);
-        if (!file.is_open()) {
-            cerr << "Error saving data to file.\n";
-            return;
+    long long syscallBytes, storageBytes;
+    processBytesRead(syscallBytes, storageBytes);
+    cout << "\n{\"loaded\":" << (loaded && loggedIn ? "true" : "false")
+         << ",\"seconds\":" << fixed << setprecision(6) << seconds
+         << ",\"peak_rss_kib\":" << jsonNumber(peakRssKiB())
+         << ",\"bytes_read\":" << jsonNumber(syscallBytes)
+         << ",\"storage_bytes_read\":" << jsonNumber(storageBytes) << "}" << endl;
+    return loaded && loggedIn ? 0 : 1;
+}
+
+// Builds a bank of `accounts` accounts with `historyPerAccount` archived
+// transactions each and `logRecords` deposits left in the log after the
+// last snapshot, then measures cold and warm recovery with the snapshot
+// loaded and mapped. Emits one JSON object per line.
+void benchmarkRecovery(const string& program, long long accounts, long long logRecords,
+                       long long historyPerAccount) {
+    string snapshotFile = "bench_recovery.dat";
+    string historyPrefix = "bench_recovery_history";
+    string logFile = "bench_recovery.wal";
+    auto cleanUp = [&] {
+        for (const string& file : recoveryFiles(snapshotFile, historyPrefix, logFile)) {
+            remove(file.c_str());
         }
+    };
+    cleanUp();
 
-        for (const auto& pair : accounts) {
-            file << pair.first << "," 
-                 << pair.second->getHolderName() << ","
-                 << pair.second->getAccountType() << ","
-                 << pair.second->getBalance() << "\n";
+    auto setupStart = chrono::steady_clock::now();
+    {
+        HistoryStore history;
+        history.open(historyPrefix);
+        time_t now = time(nullptr);
+        for (long long h = 0; h < historyPerAccount; h++) {
+            for (long long i = 0; i < accounts; i++) {
+                Transaction t;
+                t.timestamp = now - (historyPerAccount - h) * 24 * 60 * 60;
+                t.kind = KIND_DEPOSIT;
+                t.counterparty = 0;
+                t.amount = Money::fromCents(1000);
+                t.balanceAfter = Money::fromCents(1000 * (h + 1));
+                history.append(makeAccountId(FIRST_ACCOUNT_SEQUENCE + i), t);
+            }
         }
-        file.close();
     }
-
-    void loadFromFile(string filename) {
-        ifstream file(filename);
-        if (!file.is_open()) {
-            cerr << "No existing data file found. Starting fresh.\n";
-            return;
+    {
+        BankSystem bank;
+        vector<BankAccount*> owners;
+        const char* names[] = {"Alice Smith", "Bob Jones", "Carol White", "Dan Brown", "Eve Black"};
+        for (long long i = 0; i < accounts; i++) {
+            owners.push_back(bank.createAccount(names[i % 5], "1234", i % 3 == 0 ? CURRENT : SAVINGS,
+                                                Money::fromCents((i % 100000) * 125)));
         }
+        bank.saveToFile(snapshotFile);
 
-        string line;
-        while (getline(file, line)) {
-            stringstream ss(line);
-            string accNum, name, pin, typeStr, balanceStr;
-            
-            getline(ss, accNum, ',');
-            getline(ss, name, ',');
-            getline(ss, typeStr, ',');
-            getline(ss, balanceStr);
+        // Concurrent depositors so group commit keeps log setup quick
+        bank.openLog(logFile);
+        const long long writers = 16;
+        vector<thread> workers;
+        for (long long w = 0; w < writers; w++) {
+            workers.emplace_back([&, w] {
+                for (long long i = w; i < logRecords; i += writers) {
+                    owners[(i * 7919) % accounts]->deposit(Money::fromCents(100));
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+    double setupSeconds = secondsSince(setupStart);
 
-            AccountType type = static_cast<AccountType>(stoi(typeStr));
-            double balance = stod(balanceStr);
-            
-            // For simplicity, we're not loading PINs and transactions from file
-            accounts[accNum] = new BankAccount(accNum, name, "0000", type, balance);
+    long long historyBytes = 0;
+    for (const string& file : recoveryFiles(snapshotFile, historyPrefix, logFile)) {
+        if (file.compare(0, historyPrefix.size(), historyPrefix) == 0) {
+            historyBytes += max(0LL, fileSize(file));
         }
-        file.close();
     }
-};
+    cout << "{\"benchmark\":\"recovery\",\"accounts\":" << accounts << ",\"log_records\":" << logRecords
+         << ",\"history_per_account\":" << historyPerAccount
+         << ",\"snapshot_bytes\":" << fileSize(snapshotFile) << ",\"log_bytes\":" << fileSize(logFile)
+         << ",\"history_bytes\":" << historyBytes
+         << ",\"setup_seconds\":" << fixed << setprecision(3) << setupSeconds << ",\"runs\":[";
 
-// Helper functions
-void displayMainMenu() {
-    cout << "\nBanking Management System\n";
-    cout << "1. Create Account\n";
-    cout << "2. Login\n";
-    cout << "3. Admin Functions\n";
-    cout << "4. Exit\n";
-    cout << "Enter choice: ";
+    bool first = true;
+    for (string mode : {"load", "map"}) {
+        for (bool cold : {true, false}) {
+            bool dropped = true;
+            if (cold) {
+                for (const string& file : recoveryFiles(snapshotFile, historyPrefix, logFile)) {
+                    if (fileSize(file) >= 0) {
+                        dropped = dropFromPageCache(file) && dropped;
+                    }
+                }
+            }
+            string command = "\"" + program + "\" --recovery-probe " + mode + " " + snapshotFile + " " +
+                             historyPrefix + " " + logFile;
+            string result, line;
+            FILE* child = popen(command.c_str(), "r");
+            if (child) {
+                char buffer[4096];
+                while (fgets(buffer, sizeof(buffer), child)) {
+                    line = buffer;
+                    if (!line.empty() && line[0] == '{') {
+                        result = line.substr(0, line.find_last_not_of("\r\n") + 1);
+                    }
+                }
+                pclose(child);
+            }
+            cout << (first ? "" : ",") << "{\"mode\":\"" << mode << "\",\"cache\":\""
+                 << (cold ? (dropped ? "cold" : "cold-unsupported") : "warm") << "\",\"result\":"
+                 << (result.empty() ? "null" : result) << "}";
+            first = false;
+        }
+    }
+    cout << "]}" << endl;
+    cleanUp();
 }
 
-void displayCustomerMenu() {
-    cout << "\nCustomer Menu\n";
-    cout << "1. Deposit\n";
-    cout << "2. Withdraw\n";
-    cout << "3. Transfer\n";
-    cout << "4. View Statement\n";
-    cout << "5. Change PIN\n";
-    cout << "6. Logout\n";
-    cout << "Enter choice: ";
+// Usage:
+//   --bench snapshot [accountCount...]   (defaults to 1M and 10M accounts)
+//   --bench startup [accountCount...]    (defaults to 1M accounts)
+//   --bench csv-parse [rowCount...]      (defaults to 1M rows)
+//   --bench lookup [accountCount...]     (defaults to 1M and 50M accounts)
+//   --bench arena [accountCount...]      (defaults to 1M accounts)
+//   --bench sweep [accountCount...]      (defaults to 1M accounts)
+//   --bench intern [accountCount...]     (defaults to 1M accounts)
+//   --bench checkpoint [accounts] [changes] (defaults to 1M accounts, 1000 changes)
+//   --bench bgsave [accounts] [deposits]   (defaults to 1M accounts, 100000 deposits)
+//   --bench compaction [accounts] [perMonth] [months] (defaults to 10000 x 10 x 24)
+//   --bench archive [accounts] [perAccount] (defaults to 10000 x 500)
+//   --bench checksum [megabytes]         (defaults to 256 MiB)
+//   --bench ledger [accounts] [perAccount] (defaults to 10000 x 200)
+//   --bench statement [accounts] [perAccount] (defaults to 10000 x 100)
+//   --bench journal [threads] [appends]  (defaults to 8 threads x 1M appends)
+//   --bench recovery [accounts] [logRecords] [historyPerAccount]
+//                                        (defaults to 10K, 100K and 1M accounts with
+//                                         accounts/10 log records and 5 history entries each)
+//   --bench group-commit [threads] [ops] (defaults to 8 threads x 2000 ops)
+// With no benchmark name every benchmark runs with its defaults.
+int runBenchmarks(const string& program, int argc, char* argv[]) {
+    string name = argc > 0 ? argv[0] : "all";
+    vector<long long> args;
+    for (int i = 1; i < argc; i++) {
+        args.push_back(atoll(argv[i]));
+    }
+
+    if (name == "snapshot" || name == "all") {
+        vector<long long> sizes = args;
+        if (sizes.empty()) {
+            sizes = {1000000, 10000000};
+        }
+        for (long long count : sizes) {
+            benchmarkSnapshotFormats(count);
+        }
+    }
+    if (name == "startup" || name == "all") {
+        vector<long long> sizes = args;
+        if (sizes.empty()) {
+            sizes = {1000000};
+        }
+        for (long long count : sizes) {
+            benchmarkStartup(count);
+        }
+    }
+    if (name == "csv-parse" || name == "all") {
+        vector<long long> sizes = args;
+        if (sizes.empty()) {
+            sizes = {1000000};
+        }
+        for (long long count : sizes) {
+            benchmarkCsvParse(count);
+        }
+    }
+    if (name == "arena" || name == "all") {
+        vector<long long> sizes = args;
+        if (sizes.empty()) {
+            sizes = {1000000};
+        }
+        for (long long count : sizes) {
+            benchmarkArena(count);
+        }
+    }
+    if (name == "sweep" || name == "all") {
+        vector<long long> sizes = args;
+        if (sizes.empty()) {
+            sizes = {1000000};
+        }
+        for (long long count : sizes) {
+            benchmarkSweep(count);
+        }
+    }
+    if (name == "intern" || name == "all") {
+        vector<long long> sizes = args;
+        if (sizes.empty()) {
+            sizes = {1000000};
+        }
+        for (long long count : sizes) {
+            benchmarkIntern(count);
+        }
+    }
+    if (name == "lookup" || name == "all") {
+        vector<long long> sizes = args;
+        if (sizes.empty()) {
+            sizes = {1000000, 50000000};
+        }
+        for (long long count : sizes) {
+            benchmarkLookup(count);
+        }
+    }
+    if (name == "checkpoint" || name == "all") {
+        benchmarkCheckpoint(args.size() > 0 ? args[0] : 1000000, args.size() > 1 ? args[1] : 1000);
+    }
+    if (name == "bgsave" || name == "all") {
+        benchmarkBackgroundCheckpoint(args.size() > 0 ? args[0] : 1000000, args.size() > 1 ? args[1] : 100000);
+    }
+    if (name == "compaction" || name == "all") {
+        benchmarkCompaction(args.size() > 0 ? args[0] : 10000, args.size() > 1 ? args[1] : 10,
+                            args.size() > 2 ? args[2] : 24);
+    }
+    if (name == "archive" || name == "all") {
+        benchmarkArchive(args.size() > 0 ? args[0] : 10000, args.size() > 1 ? args[1] : 500);
+    }
+    if (name == "recovery" || name == "all") {
+        vector<long long> sizes = {10000, 100000, 1000000};
+        if (!args.empty()) {
+            sizes = {args[0]};
+        }
+        for (long long count : sizes) {
+            benchmarkRecovery(program, count, args.size() > 1 ? args[1] : count / 10,
+                              args.size() > 2 ? args[2] : 5);
+        }
+    }
+    if (name == "ledger" || name == "all") {
+        benchmarkLedger(args.size() > 0 ? args[0] : 10000, args.size() > 1 ? args[1] : 200);
+    }
+    if (name == "statement" || name == "all") {
+        benchmarkStatement(args.size() > 0 ? args[0] : 10000, args.size() > 1 ? args[1] : 100);
+    }
+    if (name == "journal" || name == "all") {
+        benchmarkJournal(args.size() > 0 ? args[0] : 8, args.size() > 1 ? args[1] : 1000000);
+    }
+    if (name == "checksum" || name == "all") {
+        benchmarkChecksum(args.size() > 0 ? args[0] : 256);
+    }
+    if (name == "group-commit" || name == "all") {
+        benchmarkGroupCommit(args.size() > 0 ? args[0] : 8, args.size() > 1 ? args[1] : 2000);
+    }
+    return 0;
 }
 
-void displayAdminMenu() {
-    cout << "\nAdmin Menu\n";
-    cout << "1. Apply Monthly Interest\n";
-    cout << "2. View All Accounts\n";
-    cout << "3. Back to Main Menu\n";
-    cout << "Enter choice: ";
+// Parses YYYY-MM-DD as local midnight; returns -1 if malformed
+time_t parseDate(const string& text) {
+    tm date = {};
+    istringstream in(text);
+    in >> get_time(&date, "%Y-%m-%d");
+    if (in.fail()) {
+        return -1;
+    }
+    date.tm_isdst = -1;
+    return mktime(&date);
 }
 
-AccountType getAccountType() {
-    int type;
-    while (true) {
-        cout << "Account Type:\n";
-        cout << "1. Savings Account (4% annual interest)\n";
-        cout << "2. Current Account (1% annual interest)\n";
-        cout << "Enter choice: ";
-        cin >> type;
-        
-        if (type == 1 || type == 2) {
-            return type == 1 ? SAVINGS : CURRENT;
-        }
-        cout << "Invalid choice. Please try again.\n";
+// Usage: --scan-ledger <ledger file> <from YYYY-MM-DD> <to YYYY-MM-DD> [minAmount maxAmount]
+// Prints the ledger rows in the date range (both days inclusive)
+int scanLedger(int argc, char* argv[]) {
+    if (argc != 3 && argc != 5) {
+        cerr << "Usage: --scan-ledger <ledger file> <from YYYY-MM-DD> <to YYYY-MM-DD> [minAmount maxAmount]\n";
+        return 2;
+    }
+    time_t from = parseDate(argv[1]);
+    time_t to = parseDate(argv[2]);
+    if (from < 0 || to < 0) {
+        cerr << "Dates must be written as YYYY-MM-DD.\n";
+        return 2;
+    }
+    Money minAmount = Money::fromCents(INT64_MIN);
+    Money maxAmount = Money::fromCents(INT64_MAX);
+    if (argc == 5 && (!Money::parse(argv[3], minAmount) || !Money::parse(argv[4], maxAmount))) {
+        cerr << "Amounts must be plain decimals such as 250 or -12.50.\n";
+        return 2;
     }
+
+    LedgerReader reader;
+    if (!reader.open(argv[0])) {
+        return 1;
+    }
+    auto start = chrono::steady_clock::now();
+    LedgerScanStats stats = reader.scan(from, to + 24 * 60 * 60 - 1, minAmount, maxAmount,
+                                        [](const string& accNum, const Transaction& t) {
+        cout << put_time(localtime(&t.timestamp), "%Y-%m-%d %H:%M:%S") << " | " << accNum << " | $"
+             << setw(10) << fixed << setprecision(2) << t.amount << " | $" << setw(10) << t.balanceAfter
+             << " | " << transactionText(t) << "\n";
+    });
+    double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cerr << stats.rowsMatched << " rows; read " << stats.groupsRead << " of "
+         << stats.groupsRead + stats.groupsSkipped << " row groups (" << stats.bytesRead
+         << " bytes) in " << fixed << setprecision(1) << millis << " ms\n";
+    return 0;
 }
 
-string getPin() {
-    string pin;
-    while (true) {
-        cout << "Enter 4-digit PIN: ";
-        cin >> pin;
-        
-        if (pin.length() == 4 && all_of(pin.begin(), pin.end(), ::isdigit)) {
-            return pin;
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--bench") {
+        return runBenchmarks(argv[0], argc - 2, argv + 2);
+    }
+    if (argc > 1 && string(argv[1]) == "--recovery-probe") {
+        return recoveryProbe(argc - 2, argv + 2);
+    }
+    if (argc > 1 && string(argv[1]) == "--lookup") {
+        if (argc != 4) {
+            cerr << "Usage: " << argv[0] << " --lookup <snapshot file> <account number>\n";
+            return 2;
         }
-        cout << "PIN must be 4 digits. Try again.\n";
+        return BankSystem::lookupAccount(argv[2], argv[3]) ? 0 : 1;
+    }
+    if (argc > 1 && string(argv[1]) == "--scan-ledger") {
+        return scanLedger(argc - 2, argv + 2);
     }
-}
 
-int main() {
     BankSystem bank;
-    bank.loadFromFile("bank_data.txt");
+    if (!bank.mapFromFile("bank_data.dat", true)) {
+        bank.importCsv("bank_data.txt");
+    }
+    bank.openHistory("bank_history");
+    bank.openLog("bank_data.wal");
+    bank.openIdGenerator("bank_data.ids");
 
     while (true) {
         displayMainMenu();
@@ -336,24 +6905,30 @@ int main() {
             string pin = getPin();
             AccountType type = getAccountType();
             
-            double initialDeposit = 0;
-            cout << "Enter initial deposit amount: $";
-            cin >> initialDeposit;
+            Money initialDeposit = getAmount("Enter initial deposit amount: $", true);
             
-            BankAccount* account = bank.createAccount(name, pin, type, initialDeposit);
-            cout << "\nAccount created successfully!\n";
-            cout << "Your account number is: " << account->getAccountNumber() << "\n";
+            try {
+                BankAccount* account = bank.createAccount(name, pin, type, initialDeposit);
+                cout << "\nAccount created successfully!\n";
+                cout << "Your account number is: " << account->getAccountNumber() << "\n";
+            } catch (const exception& error) {
+                reportFailure(error);
+            }
             
         } else if (choice == 2) {
             // Login
             string accNum, pin;
+            uint64_t accountId;
             cout << "Enter account number: ";
             cin >> accNum;
+            if (!parseTypedAccountNumber(accNum, accountId)) {
+                continue;
+            }
             cout << "Enter PIN: ";
             cin >> pin;
             
             int attemptsLeft = MAX_LOGIN_ATTEMPTS;
-            BankAccount* account = bank.login(accNum, pin, attemptsLeft);
+            BankAccount* account = bank.login(accountId, pin, attemptsLeft);
             
             if (account) {
                 cout << "\nLogin successful! Welcome, " << account->getHolderName() << "!\n";
@@ -363,59 +6938,74 @@ int main() {
                     int customerChoice;
                     cin >> customerChoice;
                     
-                    if (customerChoice == 1) {
-                        // Deposit
-                        double amount;
-                        cout << "Enter deposit amount: $";
-                        cin >> amount;
-                        account->deposit(amount);
-                        cout << "Deposit successful. New balance: $" 
-                             << fixed << setprecision(2) << account->getBalance() << "\n";
+                    try {
+                        if (customerChoice == 1) {
+                            // Deposit
+                            Money amount = getAmount("Enter deposit amount: $");
+                            account->deposit(amount);
+                            cout << "Deposit successful. New balance: $" << account->getBalance() << "\n";
                             
-                    } else if (customerChoice == 2) {
-                        // Withdraw
-                        double amount;
-                        cout << "Enter withdrawal amount: $";
-                        cin >> amount;
+                        } else if (customerChoice == 2) {
+                            // Withdraw
+                            Money amount = getAmount("Enter withdrawal amount: $");
                         
-                        if (account->withdraw(amount)) {
-                            cout << "Withdrawal successful. New balance: $" 
-                                 << fixed << setprecision(2) << account->getBalance() << "\n";
-                        } else {
-                            cout << "Insufficient funds!\n";
-                        }
+                            if (account->withdraw(amount)) {
+                                cout << "Withdrawal successful. New balance: $" << account->getBalance() << "\n";
+                            } else {
+                                cout << "Insufficient funds!\n";
+                            }
                         
-                    } else if (customerChoice == 3) {
-                        // Transfer
-                        string toAccount;
-                        double amount;
-                        cout << "Enter recipient account number: ";
-                        cin >> toAccount;
-                        cout << "Enter transfer amount: $";
-                        cin >> amount;
+                        } else if (customerChoice == 3) {
+                            // Transfer
+                            string toAccount;
+                            cout << "Enter recipient account number: ";
+                            cin >> toAccount;
+                            Money amount = getAmount("Enter transfer amount: $");
                         
-                        if (bank.transfer(account, toAccount, amount)) {
-                            cout << "Transfer successful. New balance: $" 
-                                 << fixed << setprecision(2) << account->getBalance() << "\n";
-                        } else {
-                            cout << "Transfer failed. Check recipient account or balance.\n";
-                        }
+                            uint64_t toAccountId;
+                            if (!parseTypedAccountNumber(toAccount, toAccountId)) {
+                                continue;
+                            }
+                            if (bank.transfer(account, toAccountId, amount)) {
+                                cout << "Transfer successful. New balance: $" << account->getBalance() << "\n";
+                            } else {
+                                cout << "Transfer failed. Check recipient account or balance.\n";
+                            }
                         
-                    } else if (customerChoice == 4) {
-                        // View Statement
-                        account->printStatement();
+                        } else if (customerChoice == 4) {
+                            // View Statement
+                            account->printStatement();
                         
-                    } else if (customerChoice == 5) {
-                        // Change PIN
-                        string newPin = getPin();
-                        account->changePin(newPin);
-                        cout << "PIN changed successfully.\n";
+                        } else if (customerChoice == 5) {
+                            // Change PIN
+                            string newPin = getPin();
+                            account->changePin(newPin);
+                            cout << "PIN changed successfully.\n";
                         
-                    } else if (customerChoice == 6) {
-                        // Logout
-                        break;
-                    } else {
-                        cout << "Invalid choice. Try again.\n";
+                        } else if (customerChoice == 6) {
+                            // Close Account, paying out the remaining balance
+                            string pin;
+                            cout << "Enter PIN to confirm closing the account: ";
+                            cin >> pin;
+                            if (!account->verifyPin(pin)) {
+                                cout << "Incorrect PIN. Account not closed.\n";
+                                continue;
+                            }
+                            string accNum = account->getAccountNumber();
+                            Money payout = bank.closeAccount(account);
+                            cout << "Account " << accNum << " closed. Paid out $" << payout << ".\n";
+                            bank.startCheckpoint("bank_data.dat");
+                            break;
+
+                        } else if (customerChoice == 7) {
+                            // Logout, persisting the session in the background
+                            bank.startCheckpoint("bank_data.dat");
+                            break;
+                        } else {
+                            cout << "Invalid choice. Try again.\n";
+                        }
+                    } catch (const exception& error) {
+                        reportFailure(error);
                     }
                 }
             } else {
@@ -434,19 +7024,45 @@ int main() {
                     int adminChoice;
                     cin >> adminChoice;
                     
-                    if (adminChoice == 1) {
-                        // Apply Interest
-                        bank.applyMonthlyInterest();
+                    try {
+                        if (adminChoice == 1) {
+                            // Apply Interest
+                            bank.applyMonthlyInterest();
                         
-                    } else if (adminChoice == 2) {
-                        // View All Accounts
-                        bank.printAllAccounts(password);
+                        } else if (adminChoice == 2) {
+                            // View All Accounts
+                            bank.printAllAccounts(password);
                         
-                    } else if (adminChoice == 3) {
-                        // Back
-                        break;
-                    } else {
-                        cout << "Invalid choice. Try again.\n";
+                        } else if (adminChoice == 3) {
+                            // Export CSV
+                            bank.exportCsv("bank_data.txt");
+                            cout << "Accounts exported to bank_data.txt\n";
+
+                        } else if (adminChoice == 4) {
+                            // Storage Statistics
+                            bank.printLogStats();
+                            bank.printCheckpointStats();
+                            bank.printCompactionStats();
+                            bank.printWarmerStats();
+
+                        } else if (adminChoice == 5) {
+                            // Compact History
+                            bank.startHistoryCompaction();
+                            cout << "History compaction started in the background.\n";
+
+                        } else if (adminChoice == 6) {
+                            // Export Ledger
+                            uint64_t rows = bank.exportLedger("bank_ledger.col");
+                            cout << rows << " transactions exported to bank_ledger.col\n";
+
+                        } else if (adminChoice == 7) {
+                            // Back
+                            break;
+                        } else {
+                            cout << "Invalid choice. Try again.\n";
+                        }
+                    } catch (const exception& error) {
+                        reportFailure(error);
                     }
                 }
             } else {
@@ -455,7 +7071,7 @@ int main() {
             
         } else if (choice == 4) {
             // Exit
-            bank.saveToFile("bank_data.txt");
+            bank.checkpoint("bank_data.dat");
             cout << "Thank you for using our banking system!\n";
             break;
             